@@ -44,9 +44,18 @@ struct backend {
 	void (*dispatch)(int fd);
 	int (*get_fd)();
 };
+struct framebuffer;
 struct backend_display_ext {
 	struct backend backend;
 	bool (*is_focus)();
+	// whether the display can scale the framebuffer by itself, in which case
+	// the framebuffer can be kept at the native resolution.
+	bool (*can_scale)();
+	// whether the display can take a framebuffer in 'format' (an enum
+	// render_format); the smallest one it can take is used.
+	bool (*supports_format)(int format);
+	// called once the framebuffer is set up, after init().
+	void (*set_framebuffer)(const struct framebuffer *fb);
 };
 struct backend_audio_ext {
 	struct backend backend;
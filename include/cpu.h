@@ -19,6 +19,7 @@
 #ifndef RB_CPU_H
 #define RB_CPU_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "monitor.h"
@@ -37,7 +38,9 @@ enum cpu_peek_type {
 	CPU_PEEK_REG,
 	CPU_PEEK_ADDR,
 	CPU_PEEK_INSTR_AT_ADDR,
-	CPU_PEEK_OP_LEN
+	CPU_PEEK_OP_LEN,
+	// 'len' bytes starting at 'req'
+	CPU_PEEK_MEM
 };
 
 // for requesting interrupts when calling cpu_request_intr().
@@ -54,8 +57,20 @@ void cpu_init();
 // access cpu's internal state.
 void cpu_wr(uint16_t addr, uint8_t value);
 uint8_t cpu_rd(uint16_t addr);
+// direct access to the ram backing 'addr' (wram or hram), or nullptr.
+uint8_t *cpu_get_mem_ptr(uint16_t addr);
 
-void cpu_peek(struct peek *peek, struct peek_reply *reply);
+int cpu_peek(struct peek *peek, struct peek_reply *reply);
+
+// the address of the next instruction; cheaper than a peek, for checking
+// breakpoints after every instruction.
+uint16_t cpu_get_pc();
+
+// snapshots of the cpu state (see monitor_save()).
+// cpu_save() returns the size of the snapshot; with a nullptr 'buf', it just
+// returns the size.
+size_t cpu_save(uint8_t *buf);
+size_t cpu_load(const uint8_t *buf);
 
 // execute the next instruction.
 int cpu_exec_next();
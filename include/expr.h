@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef RB_EXPR_H
+#define RB_EXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// conditions for breakpoints and logpoints, compiled by the client to a tiny
+// stack bytecode, and evaluated in the emulator without stopping it.
+// eg, "pc == 0x1234 && a == 3":
+//  EXPR_REG CPU_REG_PC, EXPR_IMM 0x1234, EXPR_EQ,
+//  EXPR_REG EXPR_REG_A, EXPR_IMM 3, EXPR_EQ, EXPR_AND, EXPR_END
+// values are 32-bit signed; the condition holds if the result isn't 0.
+enum expr_op {
+	EXPR_END, // the result is on top of the stack
+	EXPR_IMM, // u16 operand: push it
+	EXPR_REG, // u8 operand (enum expr_reg): push the register
+	EXPR_MEM, // pop an address, push the byte there
+	EXPR_ACCESS_ADDR, // push the address of the access (watchpoints)
+	EXPR_ACCESS_VALUE, // push the value read/written (watchpoints)
+	EXPR_EQ,
+	EXPR_NE,
+	EXPR_LT,
+	EXPR_LE,
+	EXPR_GT,
+	EXPR_GE,
+	EXPR_AND,
+	EXPR_OR,
+	EXPR_NOT,
+	EXPR_BAND,
+	EXPR_BOR,
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_NUM_OPS
+};
+
+// the 16-bit ones are enum cpu_reg.
+enum expr_reg {
+	EXPR_REG_A = 0x10,
+	EXPR_REG_F,
+	EXPR_REG_B,
+	EXPR_REG_C,
+	EXPR_REG_D,
+	EXPR_REG_E,
+	EXPR_REG_H,
+	EXPR_REG_L
+};
+
+// the memory access that triggered a watchpoint.
+struct expr_access {
+	uint16_t addr;
+	uint8_t value;
+};
+
+// whether 'code' is well formed: known ops and registers, no stack under or
+// overflow, and a single EXPR_END at the end.
+// returns -1 if not.
+int expr_check(const uint8_t *code, size_t len);
+// 'code' must have passed expr_check(); 'access' may be nullptr.
+bool expr_eval(const uint8_t *code, const struct expr_access *access);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RB_JOYPAD_H
+#define RB_JOYPAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the buttons, as bits of the joypad state.
+// the low nibble is the direction keys, the high one the action buttons, in
+// the order they show up in the P1 register (0xff00).
+enum joypad_button {
+	JOYPAD_RIGHT = 1,
+	JOYPAD_LEFT = 1 << 1,
+	JOYPAD_UP = 1 << 2,
+	JOYPAD_DOWN = 1 << 3,
+	JOYPAD_A = 1 << 4,
+	JOYPAD_B = 1 << 5,
+	JOYPAD_SELECT = 1 << 6,
+	JOYPAD_START = 1 << 7
+};
+
+// queue a button press/release.
+// it's meant to be called from the thread handling the input devices (only
+// one); the emulation picks the event up on the next joypad_sync().
+// 'time' is the time of the event (CLOCK_MONOTONIC, in ns), as reported by the
+// input device; it's used to measure the input latency (see latency.h).
+void joypad_push_event(enum joypad_button button, bool is_pressed, int64_t time);
+
+// apply the queued events to the joypad state, and request the joypad
+// interrupt if a selected button went down.
+// the monitor calls this once per scanline worth of cycles, so that input is
+// seen at the same points of the emulation regardless of when it arrives.
+void joypad_sync();
+
+// the buttons currently pressed, as seen by the emulation.
+uint8_t joypad_get_state();
+
+// access the P1 register (0xff00).
+uint8_t joypad_rd();
+// the value of P1, for the debugger and such; not a read by the game.
+uint8_t joypad_peek();
+void joypad_wr(uint8_t value);
+
+// snapshots of the joypad state; like cpu_save() and cpu_load().
+// queued events aren't part of it.
+size_t joypad_save(uint8_t *buf);
+size_t joypad_load(const uint8_t *buf);
+
+#endif
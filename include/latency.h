@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RB_LATENCY_H
+#define RB_LATENCY_H
+
+#include <stdint.h>
+
+// input-to-photon latency.
+// an input event is followed through the emulator: the emulated frame that
+// first reads the changed joypad state (through P1), the commit of the first
+// frame at least as recent as that one, and its presentation.
+// all times are CLOCK_MONOTONIC, in ns.
+
+// the emulation read a joypad change, caused by an input event at
+// 'input_time', while emulating frame number 'frame'.
+void latency_input_read(int64_t input_time, uint32_t frame);
+
+// the display backend committed/presented frame number 'frame'.
+// 'will_be_presented' tells whether latency_frame_presented() follows (eg,
+// the display has presentation feedback).
+void latency_frame_committed(uint32_t frame, int64_t time, bool will_be_presented);
+void latency_frame_presented(uint32_t frame, int64_t time);
+
+struct latency_stats {
+	// over the last LATENCY_WINDOW samples.
+	unsigned num_samples;
+	int64_t commit_p50;
+	int64_t commit_p99;
+	unsigned num_presented_samples;
+	int64_t present_p50;
+	int64_t present_p99;
+};
+#define LATENCY_WINDOW 256
+struct latency_stats latency_get_stats();
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef RB_LIVEVIEW_H
+#define RB_LIVEVIEW_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// a live view of the emulator's memory, for external tools (eg, bots,
+// dashboards) to read while the emulation runs.
+// it's a memfd, handed to monitor clients over the libemu socket, that the
+// emulator brings up to date at the end of every frame.
+//
+// readers get a consistent copy through the seqlock:
+//  do {
+//   seq = atomic_load_explicit(&view->seq, memory_order_acquire);
+//   (copy what's needed)
+//   atomic_thread_fence(memory_order_acquire);
+//  } while ((seq & 1) || seq != atomic_load_explicit(&view->seq, memory_order_relaxed));
+
+#define LIVEVIEW_MAGIC 0x56424c52 // "RLBV"
+#define LIVEVIEW_VERSION 1
+
+struct liveview {
+	uint32_t magic;
+	uint32_t version;
+	// odd while the emulator is writing.
+	_Atomic uint32_t seq;
+	uint32_t reserved;
+	// the frame that just ended.
+	uint64_t frame;
+	uint8_t vram[0x2000]; // 0x8000-0x9fff
+	uint8_t wram[0x2000]; // 0xc000-0xdfff
+	uint8_t oam[0xa0]; // 0xfe00-0xfe9f
+	uint8_t io[0x80]; // 0xff00-0xff7f
+	uint8_t hram[0x7f]; // 0xff80-0xfffe
+	uint8_t ie; // 0xffff
+};
+
+// create the memfd the first time; returns it, or -1.
+// from any thread.
+int liveview_get_fd();
+size_t liveview_get_size();
+
+// called by the emulation at the end of every frame; nothing to do until
+// there's a live view.
+void liveview_update(uint64_t frame);
+
+void liveview_fini();
+
+#endif
@@ -19,6 +19,7 @@
 #ifndef RB_MONITOR_H
 #define RB_MONITOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <linux/input.h>
@@ -26,6 +27,9 @@
 // the 'peek' interface.
 // it is implemented by the modules (eg, cpu_peek(), ppu_peek()) to read their
 // state in the context of an IPC request.
+// the reply goes into a buffer provided by the caller: registers as u32,
+// memory as packed bytes.
+// peeks return -1 if the reply doesn't fit.
 enum peek_type {
 	PEEK_CPU,
 	PEEK_PPU,
@@ -34,19 +38,42 @@ struct peek {
 	enum peek_type type;
 	uint32_t subtype;
 	uint32_t req;
+	uint32_t len; // for peeks of ranges
 };
 struct peek_reply {
-	size_t size;
+	size_t size; // bytes written so far
+	size_t capacity;
 	void *payload;
 };
 
+// append 'len' bytes to the reply.
+int peek_reply_put(struct peek_reply *reply, const void *data, size_t len);
+
 // main loop for the execution environment.
 // call this function to run the emulator.
 int monitor_run();
+// make monitor_run() return 'ret', from the emulation thread.
+void monitor_quit(int ret);
 
 void monitor_server_request();
 
+// wait until it's time for the next frame.
+// frames are paced against absolute deadlines, at the dmg rate (~59.73Hz);
+// if the display reports presentation times (see
+// monitor_report_presentation()) and refreshes at about the same rate, at
+// the display's rate and in phase with it.
 void monitor_throttle_fps();
+// called by the ppu as each frame ends; brings the live view up to date
+// (see liveview.h) and waits for the next frame.
+void monitor_end_frame();
+// run as fast as possible (eg, to play back a movie); on by default.
+void monitor_set_throttle(bool throttle);
+bool monitor_is_throttled();
+
+// the display backend calls this when a frame was presented.
+// 'presented' is the CLOCK_MONOTONIC time, in ns; 'refresh' is the
+// display's refresh period, in ns (0 if unknown).
+void monitor_report_presentation(int64_t presented, uint32_t refresh);
 
 // read/write to an arbitrary address.
 // the monitor maps the address to the correct memory mechanism:
@@ -55,6 +82,51 @@ void monitor_throttle_fps();
 //  monitor_rd_mem(0xff40) reads from the ppu's lcdc register
 uint8_t monitor_rd_mem(uint16_t addr);
 void monitor_wr_mem(uint16_t addr, uint8_t value);
+// read like monitor_rd_mem(), but for instruction fetches: read watches
+// don't see them (executing is MONITOR_WATCH_EXEC's business).
+uint8_t monitor_fetch_mem(uint16_t addr);
+// read like monitor_rd_mem(), but for the debugger and such: no side effects,
+// and no watches.
+uint8_t monitor_peek_mem(uint16_t addr);
+
+// memory watches.
+// accesses to pages (0x100 bytes) flagged with the kind of access go through
+// the handler, before they happen; the rest don't pay for it.
+// 'old_value' is what's at 'addr' before a write ('new_value' for a read).
+enum monitor_watch {
+	MONITOR_WATCH_READ = 1,
+	MONITOR_WATCH_WRITE = 1 << 1,
+	MONITOR_WATCH_EXEC = 1 << 2 // not checked by the monitor; see server.c
+};
+typedef void (*monitor_watch_fn)(enum monitor_watch kind, uint16_t addr, uint8_t old_value,
+	uint8_t new_value);
+void monitor_set_watch_handler(monitor_watch_fn handler);
+void monitor_set_watch_page(uint8_t page, uint8_t kinds);
+
+// direct access to the memory backing 'addr'; nullptr if 'addr' isn't backed
+// by plain memory (eg, io registers).
+// '*len' is set to how many bytes from 'addr' on are valid: up to the end of
+// its 0x100-byte page, or of the memory if that's shorter (oam ends at
+// 0xfe9f, hram at 0xfffe).
+// it's meant for bulk transfers (eg, oam dma); writing through it skips any
+// side effects of writing to the address.
+uint8_t *monitor_get_mem_ptr(uint16_t addr, size_t *len);
+// m-cycles executed since power on.
+uint64_t monitor_get_cycle_count();
+// the cartridge rom bank mapped at 0x4000-0x7fff.
+uint16_t monitor_get_rom_bank();
+
+// snapshots of the whole machine state.
+// monitor_save() returns the size of the snapshot; with a nullptr 'buf', it
+// just returns the size.
+// snapshots are meant to be taken, and loaded, at joypad sync points (see
+// joypad_sync()), between instructions.
+size_t monitor_save(uint8_t *buf);
+void monitor_load(const uint8_t *buf);
+
+// execute one instruction, outside of monitor_run() (eg, to re-execute from
+// a snapshot).
+void monitor_step();
 
 // interfaces with the system's input mechanism.
 // eg, the wayland driver calls this to inform about the linux input EV_KEY.
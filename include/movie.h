@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RB_MOVIE_H
+#define RB_MOVIE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// input movies.
+// a movie holds the joypad state at every point the emulation picks up input
+// (see joypad_sync()), so that playing it back from the same initial state
+// (power on, with the same rom) runs the exact same emulation.
+// when a recording ends, the movie gets a hash of the machine state, which
+// playback checks.
+//
+// file format (native endianness):
+//  header: "RBMV", u32 version, u64 rom hash, u32 initial state (0: power on)
+//  records: u8 type, u64 sync point, then
+//   MOVIE_RECORD_INPUT: u8 joypad state (enum joypad_button bits)
+//   MOVIE_RECORD_END: u64 state hash
+//
+// long movies can be verified in parallel: a reference run (recording, or
+// playing back) can write keyframes, snapshots of the machine state taken
+// every so often, to a file of their own.
+// verification then plays back each stretch between keyframes in a process of
+// its own, starting from the snapshot, and checks that the state reached at
+// the next keyframe hashes the same.
+
+// one of these, before monitor_init().
+int movie_record(const char *path, FILE *rom);
+int movie_play(const char *path, FILE *rom);
+
+bool movie_is_playing();
+
+// write keyframes while recording or playing back; after movie_record() or
+// movie_play().
+int movie_write_keyframes(const char *path);
+
+// verify the movie being played back against the keyframes at 'path', with
+// up to 'jobs' segments played back at once.
+// instead of monitor_run(); returns 0 if every segment matched.
+int movie_verify(const char *keyframes_path, int jobs);
+
+// end the recording at the next sync point.
+// async-signal-safe.
+void movie_stop();
+
+// called by the joypad at every sync point, with the live joypad state;
+// returns the state the emulation should see.
+uint8_t movie_sync(uint8_t pressed);
+
+// whether the played back movie ended with the same state it was recorded
+// with (or nothing was played back).
+bool movie_is_ok();
+
+void movie_fini();
+
+#endif
@@ -19,6 +19,7 @@
 #ifndef RB_PPU_H
 #define RB_PPU_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "monitor.h"
@@ -34,16 +35,42 @@ enum ppu_peek_type {
 	PPU_PEEK_REG
 };
 
+// when to draw the scanlines.
+//  PPU_RASTER_LINE draws each line as the ppu finishes its draw phase.
+//  PPU_RASTER_FRAME draws the whole frame at once at the end of vblank.
+//  PPU_RASTER_THREAD draws the whole frame in a separate thread, so that
+//  drawing and scaling run in parallel with the emulation.
+// all of them produce the same image (see the write log in emu/ppu/ppu.h).
+enum ppu_raster_mode {
+	PPU_RASTER_LINE,
+	PPU_RASTER_FRAME,
+	PPU_RASTER_THREAD
+};
+
+// must be called before ppu_init().
+void ppu_set_raster_mode(enum ppu_raster_mode mode);
+
+int ppu_init();
+void ppu_fini();
+
 // get the total number of frames since the start
 // of the emulation.
 uint64_t ppu_get_frame_count();
+// frames that weren't drawn because nothing changed since the previous one.
+uint64_t ppu_get_skipped_frame_count();
 
 void ppu_refresh(uint8_t ticks);
 
 // access ppu's internal state.
 uint8_t ppu_rd(uint16_t addr);
 void ppu_wr(uint16_t addr, uint8_t value);
+// direct access to the memory backing 'addr' (vram or oam), or nullptr.
+uint8_t *ppu_get_mem_ptr(uint16_t addr);
+
+int ppu_peek(struct peek *peek, struct peek_reply *reply);
 
-void ppu_peek(struct peek *peek, struct peek_reply *reply);
+// snapshots of the ppu state; like cpu_save() and cpu_load().
+size_t ppu_save(uint8_t *buf);
+size_t ppu_load(const uint8_t *buf);
 
 #endif
@@ -22,19 +22,64 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// number of frames in the framebuffer memory (see render.c).
+// frames 0 and 1 start out owned by the renderer, the rest by the display
+// backend.
+#define RENDER_NUM_FRAMES 4
+#define RENDER_FIRST_DISPLAY_FRAME 2
+
+// pixel formats of the framebuffer, from the smallest.
+enum render_format {
+	RENDER_FORMAT_RGB565,
+	RENDER_FORMAT_XRGB8888,
+	RENDER_NUM_FORMATS
+};
+
+// 'size' is the size of one frame.
 struct framebuffer {
 	int fd;
+	enum render_format format;
 	size_t width;
 	size_t height;
 	size_t stride;
 	size_t size;
 };
 
+struct render_frame {
+	int slot; // index of the frame in the framebuffer memory
+	uint64_t seq; // number of frames completed before this one
+	uint32_t frame; // the emulated frame it shows (mod 2^32)
+	// the rows that changed with respect to the previous frame, in
+	// framebuffer coordinates.
+	int damage_y;
+	int damage_height;
+};
+
+// these must be called before render_init().
+// the screen is scaled by an integer factor (1-8), with
+// nearest-neighbor sampling, unless 'smooth' is set, in which case it's
+// filtered bilinearly.
+int render_set_scale(int factor);
+void render_set_smooth(bool smooth);
+// the default is RENDER_FORMAT_XRGB8888.
+void render_set_format(enum render_format format);
+
 int render_init();
 void render_fini();
 
 struct framebuffer render_get_framebuffer_dimensions();
 int render_get_framebuffer_fd();
-void render_draw_pixel(int x, int y, uint32_t pixel);
-void render_draw_framebuffer();
+// readable (eventfd) when a new frame is complete.
+int render_get_frame_ready_fd();
+// 'shade' is the dmg color (0-3, lightest to darkest), after the palette
+// registers have been applied.
+void render_draw_pixel(int x, int y, uint8_t shade);
+// 'frame' is the number of the emulated frame (see ppu_get_frame_count()).
+void render_draw_framebuffer(uint32_t frame);
+
+// hand frame 'slot' back to the renderer in exchange for the last complete
+// frame, or return nullptr (keeping 'slot') if there's no new frame.
+// only the display backend calls this; 'slot' must be a frame it owns and
+// no longer shows.
+const struct render_frame *render_swap_frame(int slot);
 #endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef RB_REWIND_H
+#define RB_REWIND_H
+
+#include <stdint.h>
+
+// the history for reverse execution in the debugger.
+// while recording, a snapshot of the machine state (see monitor_save()) is
+// taken every REWIND_INTERVAL m-cycles, and every change in the joypad state
+// is logged, so that execution can be repeated exactly from any snapshot.
+// going back to any point is then loading the latest snapshot before it and
+// re-executing up to it (see server.c), which takes at most REWIND_INTERVAL
+// m-cycles of emulation, however long the session.
+
+// two frames.
+#define REWIND_INTERVAL 35112
+#define REWIND_NUM_SNAPSHOTS 256
+
+int rewind_start();
+void rewind_fini();
+
+// called by the monitor at every joypad sync point.
+void rewind_sync();
+
+// load the latest snapshot at or before 'cycle', and start re-executing from
+// it; returns the snapshot's cycle, or -1 if there's none.
+int64_t rewind_seek(uint64_t cycle);
+// re-execution is done; the history after the current point is dropped, as
+// it may not happen again (eg, with other input).
+void rewind_done();
+// the cycle of the oldest snapshot; -1 if none.
+int64_t rewind_get_oldest();
+
+// while re-executing, the joypad takes its state from the log.
+bool rewind_is_replaying();
+uint8_t rewind_get_input();
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RB_SCALER_H
+#define RB_SCALER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCALER_MAX_FACTOR 8
+
+// expand a width x height image of shades (one byte per pixel) to colors
+// through 'palette', scaling it by an integer 'factor' (1-SCALER_MAX_FACTOR)
+// with nearest-neighbor sampling.
+// the colors are 'bpp' (2 or 4) bytes wide, and 'palette' holds them as
+// they are to be stored (eg, rgb565 in the low 16 bits).
+// 'dst_stride' is in bytes.
+void scaler_scale(void *dst, size_t dst_stride, const uint8_t *src, size_t width,
+	size_t height, const uint32_t palette[4], int bpp, int factor);
+
+#endif
@@ -21,10 +21,13 @@
 
 #define _POSIX_C_SOURCE 200809L
 
-#include <pthread.h>
 #include <stdint.h>
 
-int server_recv_request_and_dispatch();
+// on the io thread.
+int server_recv_request();
+// on the emulation thread.
+int server_dispatch_requests();
+void server_wait_requests();
 int server_init(bool wait_for_client);
 void server_fini();
 int server_get_fd();
@@ -32,8 +35,4 @@ bool server_is_client_connected();
 bool server_is_stopped();
 bool server_should_stop_execution();
 
-extern pthread_mutex_t mtx_server;
-extern pthread_cond_t cnd_server_stop;
-extern pthread_rwlock_t quick_lock;
-
 #endif
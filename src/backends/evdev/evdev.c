@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
@@ -128,6 +129,11 @@ int evdev_init() {
 				perror("epoll_ctl()");
 				goto err;
 			}
+			// timestamp the events with the same clock as the frames, to
+			// measure the input latency.
+			if (libevdev_set_clock_id(evdev, CLOCK_MONOTONIC) != 0) {
+				fprintf(stderr, "libevdev_set_clock_id()");
+			}
 			evdevs[num_evdevs++] = evdev;
 		}
 		else {
@@ -24,26 +24,30 @@
 struct wl_display *display;
 
 static void backend_dispatch(int fd) {
-	if (fd == wl_display_get_fd(display)) {
-		wl_display_dispatch(display);
-	}
+	wayland_dispatch(fd);
 }
 
 static int backend_get_fd() {
-	return wl_display_get_fd(display);
+	return wayland_get_fd();
 }
 
 static void backend_fini() {
-	wl_display_disconnect(display);
+	wayland_fini();
 }
 
 static int backend_init() {
 	display = wayland_init();
+	if (!display) {
+		return -1;
+	}
 
 	return 0;
 }
 
 extern bool wayland_is_focus();
+extern bool wayland_can_scale();
+extern bool wayland_supports_format(int format);
+extern void wayland_set_framebuffer(const struct framebuffer *fb);
 struct backend_display_ext wayland_backend_iface =
 {
 	.backend.type = BACKEND_DISPLAY,
@@ -51,6 +55,9 @@ struct backend_display_ext wayland_backend_iface =
 	.backend.fini = backend_fini,
 	.backend.get_fd = backend_get_fd,
 	.backend.dispatch = backend_dispatch,
-	.is_focus = wayland_is_focus
+	.is_focus = wayland_is_focus,
+	.can_scale = wayland_can_scale,
+	.supports_format = wayland_supports_format,
+	.set_framebuffer = wayland_set_framebuffer
 };
 
@@ -17,13 +17,22 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-client-core.h>
 
 #include "wayland-client.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
+#include "latency.h"
+#include "monitor.h"
 #include "render.h"
 
 typedef struct {
@@ -42,16 +51,78 @@ typedef struct {
 	struct xdg_wm_base *wm_base;
 	struct wl_callback *frame_callback;
 
+	// one wl_buffer per frame in the framebuffer memory.
+	struct wl_buffer *buffers[RENDER_NUM_FRAMES];
+	bool is_buffer_owned[RENDER_NUM_FRAMES]; // we got it from the renderer
+	bool is_buffer_busy[RENDER_NUM_FRAMES]; // the compositor hasn't released it
+	int front; // the frame attached to the surface, or -1
+	uint64_t front_seq;
+	// the compositor is ready for a new frame (ie, the frame callback fired).
+	bool can_commit;
+
+	bool has_shm_rgb565;
+
+	// polls both the wayland display and the renderer's frame ready fd.
+	int poll_fd;
+
+	// if the compositor supports wp_viewporter, the framebuffer is submitted
+	// as is, and the compositor scales it to the size of the window.
+	struct wp_viewporter *viewporter;
+	struct wp_viewport *viewport;
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+	struct wp_fractional_scale_v1 *fractional_scale;
+	uint32_t preferred_scale; // in 120ths, as sent by the compositor
+	int32_t width; // size of the window, in surface coordinates
+	int32_t height;
+	bool size_changed;
+	bool is_size_from_compositor;
+
+	// if the compositor supports wp_presentation, it tells us when each
+	// frame hits the screen, and the monitor paces the frames after it.
+	struct wp_presentation *presentation;
+	bool is_presentation_clock_usable; // the compositor's clock is CLOCK_MONOTONIC
+
 	bool window_configured;
 	bool is_surface_focused;
 } wayland_t;
 wayland_t wayland;
 
+#define DEFAULT_WINDOW_SCALE 4
+
+// without a size from the compositor, make the window DEFAULT_WINDOW_SCALE
+// times the native resolution, in physical pixels, so that each dmg pixel
+// covers a whole number of them.
+static void set_default_window_size() {
+	wayland_t *w = &wayland;
+	uint32_t scale = w->preferred_scale ? w->preferred_scale : 120;
+
+	w->width = (160*DEFAULT_WINDOW_SCALE*120 + scale/2) / scale;
+	w->height = (144*DEFAULT_WINDOW_SCALE*120 + scale/2) / scale;
+	w->size_changed = true;
+}
+
 static void
 handle_xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
 			      int32_t width, int32_t height,
 			      struct wl_array *states)
 {
+	wayland_t *w = &wayland;
+
+	// without a viewport, the size of the window is the size of the framebuffer.
+	if (!w->viewport) {
+		return;
+	}
+
+	// 0x0 means that we pick the size.
+	if (!width || !height) {
+		return;
+	}
+	w->is_size_from_compositor = true;
+	if (width != w->width || height != w->height) {
+		w->width = width;
+		w->height = height;
+		w->size_changed = true;
+	}
 }
 
 static void
@@ -74,16 +145,18 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 	.wm_capabilities = handle_xdg_wm_capabilities
 };
 
-void backend_wayland_update_frame();
+static void present();
 static void
 handle_xdg_surface_configure(void *data, struct xdg_surface *surface, uint32_t serial)
 {
-	static bool configured;
+	wayland_t *w = &wayland;
+
 	xdg_surface_ack_configure(surface, serial);
-	if (!configured) {
-		configured = true;
-		backend_wayland_update_frame();
+	if (!w->window_configured) {
+		w->window_configured = true;
+		w->can_commit = true;
 	}
+	present();
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -150,6 +223,63 @@ static void xdg_wm_base_ping(void *data, struct xdg_wm_base *shell, uint32_t ser
 static const struct xdg_wm_base_listener xdg_wm_base_listener = {
 	xdg_wm_base_ping,
 };
+
+static void handle_preferred_scale(void *data,
+		struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+	wayland_t *w = &wayland;
+
+	w->preferred_scale = scale;
+	if (!w->is_size_from_compositor) {
+		set_default_window_size();
+	}
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale = handle_preferred_scale
+};
+static void handle_shm_format(void *data, struct wl_shm *wl_shm, uint32_t format) {
+	if (format == WL_SHM_FORMAT_RGB565)
+		wayland.has_shm_rgb565 = true;
+}
+
+static const struct wl_shm_listener shm_listener = {
+	.format = handle_shm_format
+};
+
+static void handle_presentation_clock_id(void *data,
+	struct wp_presentation *wp_presentation, uint32_t clk_id) {
+	wayland.is_presentation_clock_usable = clk_id == CLOCK_MONOTONIC;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	.clock_id = handle_presentation_clock_id
+};
+
+static void handle_feedback_sync_output(void *data,
+	struct wp_presentation_feedback *feedback, struct wl_output *output) {
+}
+
+static void handle_feedback_presented(void *data,
+	struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+	uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+	int64_t sec = ((int64_t)tv_sec_hi << 32) | tv_sec_lo;
+	int64_t presented = sec * 1000000000L + tv_nsec;
+	monitor_report_presentation(presented, refresh);
+	latency_frame_presented((uintptr_t)data, presented);
+	wp_presentation_feedback_destroy(feedback);
+}
+
+static void handle_feedback_discarded(void *data,
+	struct wp_presentation_feedback *feedback) {
+	wp_presentation_feedback_destroy(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = handle_feedback_sync_output,
+	.presented = handle_feedback_presented,
+	.discarded = handle_feedback_discarded
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
 	uint32_t id, const char *interface, uint32_t version) {
@@ -160,9 +290,18 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		xdg_wm_base_add_listener(wayland.wm_base, &xdg_wm_base_listener, NULL);
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		wayland.shm = wl_registry_bind(registry, id, &wl_shm_interface, 2);
+		wl_shm_add_listener(wayland.shm, &shm_listener, NULL);
 	} else if (strcmp(interface, "wl_seat") == 0) {
 		wayland.seat = wl_registry_bind(registry, id, &wl_seat_interface, 9);
 		wl_seat_add_listener(wayland.seat, &seat_listener, NULL);
+	} else if (strcmp(interface, "wp_viewporter") == 0) {
+		wayland.viewporter = wl_registry_bind(registry, id, &wp_viewporter_interface, 1);
+	} else if (strcmp(interface, "wp_fractional_scale_manager_v1") == 0) {
+		wayland.fractional_scale_manager = wl_registry_bind(registry, id,
+			&wp_fractional_scale_manager_v1_interface, 1);
+	} else if (strcmp(interface, "wp_presentation") == 0) {
+		wayland.presentation = wl_registry_bind(registry, id, &wp_presentation_interface, 1);
+		wp_presentation_add_listener(wayland.presentation, &presentation_listener, NULL);
 	}
 }
 
@@ -179,21 +318,73 @@ bool wayland_is_focus() {
 	return wayland.is_surface_focused;
 }
 
-void set_framebuffer(const struct framebuffer *fb) {
+bool wayland_can_scale() {
+	return wayland.viewport;
+}
+
+bool wayland_supports_format(int format) {
+	switch (format) {
+		case RENDER_FORMAT_RGB565:
+			return wayland.has_shm_rgb565;
+		case RENDER_FORMAT_XRGB8888:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static uint32_t get_shm_format(enum render_format format) {
+	switch (format) {
+		case RENDER_FORMAT_RGB565:
+			return WL_SHM_FORMAT_RGB565;
+		case RENDER_FORMAT_XRGB8888:
+		default:
+			return WL_SHM_FORMAT_XRGB8888;
+	}
+}
+
+static void handle_buffer_release(void *data, struct wl_buffer *buffer) {
+	wayland_t *w = &wayland;
+
+	w->is_buffer_busy[(intptr_t)data] = false;
+	present();
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = handle_buffer_release
+};
+
+void wayland_set_framebuffer(const struct framebuffer *fb) {
 	wayland_t *w = &wayland;
 
 	w->framebuffer = *fb;
-	w->shm_pool = wl_shm_create_pool(w->shm, w->framebuffer.fd, w->framebuffer.size);
+	w->shm_pool = wl_shm_create_pool(w->shm, w->framebuffer.fd,
+		w->framebuffer.size * RENDER_NUM_FRAMES);
+	for (intptr_t i = 0; i < RENDER_NUM_FRAMES; i++) {
+		w->buffers[i] = wl_shm_pool_create_buffer(w->shm_pool, i * fb->size,
+			fb->width, fb->height, fb->stride, get_shm_format(fb->format));
+		wl_buffer_add_listener(w->buffers[i], &buffer_listener, (void *)i);
+		w->is_buffer_owned[i] = i >= RENDER_FIRST_DISPLAY_FRAME;
+	}
+	w->front = -1;
+
+	if (epoll_ctl(w->poll_fd, EPOLL_CTL_ADD, render_get_frame_ready_fd(),
+			&(struct epoll_event) {
+			.events = EPOLLIN,
+			.data.fd = render_get_frame_ready_fd()
+		}) == -1) {
+		perror("epoll_ctl()");
+	}
 }
 
 static const struct wl_callback_listener frame_listener;
-void backend_wayland_update_frame() {
+static void commit() {
 	wayland_t *w = &wayland;
-	struct framebuffer *fb = &w->framebuffer;
 
-	struct wl_buffer *wl_buf = wl_shm_pool_create_buffer(w->shm_pool, 0, fb->width, fb->height, fb->stride, WL_SHM_FORMAT_XRGB8888);
-	wl_surface_attach(w->surface, wl_buf, 0, 0);
-	wl_surface_damage(w->surface, 0, 0, fb->width, fb->height);
+	if (w->viewport && w->size_changed) {
+		wp_viewport_set_destination(w->viewport, w->width, w->height);
+		w->size_changed = false;
+	}
 	if (w->frame_callback)
 		wl_callback_destroy(w->frame_callback);
 
@@ -201,18 +392,114 @@ void backend_wayland_update_frame() {
 	wl_callback_add_listener(w->frame_callback, &frame_listener, NULL);
 	wl_surface_commit(w->surface);
 	wl_display_flush(w->display);
+	w->can_commit = false;
+}
+
+// show the last complete frame, if there's a new one and the compositor is
+// ready for it.
+static void present() {
+	wayland_t *w = &wayland;
+	struct framebuffer *fb = &w->framebuffer;
+
+	if (!w->buffers[0] || !w->can_commit) {
+		return;
+	}
+
+	// we need a frame to give back to the renderer in exchange for the new one.
+	int spare = -1;
+	for (int i = 0; i < RENDER_NUM_FRAMES; i++) {
+		if (w->is_buffer_owned[i] && !w->is_buffer_busy[i] && i != w->front) {
+			spare = i;
+			break;
+		}
+	}
+	const struct render_frame *frame = spare != -1 ? render_swap_frame(spare) : nullptr;
+	if (!frame) {
+		// no new frame, but a resize still has to be applied.
+		if (w->viewport && w->size_changed && w->front != -1) {
+			commit();
+		}
+		return;
+	}
+	w->is_buffer_owned[spare] = false;
+	w->is_buffer_owned[frame->slot] = true;
+	w->is_buffer_busy[frame->slot] = true;
+
+	wl_surface_attach(w->surface, w->buffers[frame->slot], 0, 0);
+	// the damage is relative to the previous frame; if we skipped any, it's
+	// not good for us.
+	if (w->front != -1 && frame->seq == w->front_seq+1) {
+		wl_surface_damage_buffer(w->surface, 0, frame->damage_y, fb->width,
+			frame->damage_height);
+	}
+	else {
+		wl_surface_damage_buffer(w->surface, 0, 0, fb->width, fb->height);
+	}
+	w->front = frame->slot;
+	w->front_seq = frame->seq;
+
+	bool has_feedback = w->presentation && w->is_presentation_clock_usable;
+	if (has_feedback) {
+		struct wp_presentation_feedback *feedback =
+			wp_presentation_feedback(w->presentation, w->surface);
+		wp_presentation_feedback_add_listener(feedback, &feedback_listener,
+			(void *)(uintptr_t)frame->frame);
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency_frame_committed(frame->frame, now.tv_sec * 1000000000L + now.tv_nsec, has_feedback);
+
+	commit();
 }
 
 static void done(void *data, struct wl_callback *wl_callback,
 	uint32_t callback_data) {
-
-	backend_wayland_update_frame();
+	wayland.can_commit = true;
+	present();
 }
 
 static const struct wl_callback_listener frame_listener = {
         .done = done
 };
 
+void wayland_dispatch(int fd) {
+	wayland_t *w = &wayland;
+
+	if (fd != w->poll_fd) {
+		return;
+	}
+
+	struct epoll_event event_list[2];
+	int num_fds = epoll_wait(w->poll_fd, event_list, 2, 0);
+	for (int i = 0; i < num_fds; i++) {
+		if (event_list[i].data.fd == wl_display_get_fd(w->display)) {
+			wl_display_dispatch(w->display);
+		}
+		else {
+			eventfd_t count;
+			eventfd_read(event_list[i].data.fd, &count);
+			present();
+		}
+	}
+}
+
+int wayland_get_fd() {
+	return wayland.poll_fd;
+}
+
+void wayland_fini() {
+	wayland_t *w = &wayland;
+
+	for (int i = 0; i < RENDER_NUM_FRAMES; i++) {
+		if (w->buffers[i])
+			wl_buffer_destroy(w->buffers[i]);
+	}
+	if (w->shm_pool)
+		wl_shm_pool_destroy(w->shm_pool);
+	wl_display_disconnect(w->display);
+	close(w->poll_fd);
+}
+
 struct wl_display *wayland_init() {
 	wayland_t *w = &wayland;
 
@@ -220,14 +507,44 @@ struct wl_display *wayland_init() {
 	if (!w->display) {
 		return NULL;
 	}
+
+	w->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->poll_fd == -1) {
+		perror("epoll_create1()");
+		wl_display_disconnect(w->display);
+		return NULL;
+	}
+	if (epoll_ctl(w->poll_fd, EPOLL_CTL_ADD, wl_display_get_fd(w->display),
+			&(struct epoll_event) {
+			.events = EPOLLIN,
+			.data.fd = wl_display_get_fd(w->display)
+		}) == -1) {
+		perror("epoll_ctl()");
+		close(w->poll_fd);
+		wl_display_disconnect(w->display);
+		return NULL;
+	}
 	w->registry = wl_display_get_registry(w->display);
 	wl_registry_add_listener(w->registry,
 		&registry_listener, NULL);
 	wl_display_roundtrip(w->display);
 	assert(w->shm);
+	// and the wl_shm formats.
+	wl_display_roundtrip(w->display);
 
 	w->surface = wl_compositor_create_surface(w->compositor);
 
+	if (w->viewporter) {
+		w->viewport = wp_viewporter_get_viewport(w->viewporter, w->surface);
+		if (w->fractional_scale_manager) {
+			w->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+				w->fractional_scale_manager, w->surface);
+			wp_fractional_scale_v1_add_listener(w->fractional_scale,
+				&fractional_scale_listener, NULL);
+		}
+		set_default_window_size();
+	}
+
 	w->xdg_surface = xdg_wm_base_get_xdg_surface(w->wm_base, w->surface);
 	assert(w->xdg_surface);
 	xdg_surface_add_listener(w->xdg_surface, &xdg_surface_listener, NULL);
@@ -241,9 +558,5 @@ struct wl_display *wayland_init() {
 	wl_surface_commit(w->surface);
 	wl_display_flush(w->display);
 
-	struct framebuffer fb = render_get_framebuffer_dimensions();
-	fb.fd = render_get_framebuffer_fd();
-	set_framebuffer(&fb);
-
 	return w->display;
 }
@@ -20,6 +20,8 @@
 #define WAYLAND_H
 
 struct wl_display *wayland_init();
+void wayland_fini();
 void wayland_dispatch(int fd);
+int wayland_get_fd();
 
 #endif
@@ -133,6 +133,31 @@ uint8_t cpu_rd(uint16_t addr) {
 	}
 }
 
+uint8_t *cpu_get_mem_ptr(uint16_t addr) {
+	if (addr >= 0xc000 && addr <= 0xdfff) {
+		return &cpu.wram[addr-0xc000];
+	}
+	if (addr >= 0xff80 && addr <= 0xfffe) {
+		return &cpu.hram[addr-0xff80];
+	}
+	return nullptr;
+}
+
+uint16_t cpu_get_pc() {
+	return cpu.state.registers.pc;
+}
+
+size_t cpu_save(uint8_t *buf) {
+	if (buf)
+		memcpy(buf, &cpu, sizeof(cpu));
+	return sizeof(cpu);
+}
+
+size_t cpu_load(const uint8_t *buf) {
+	memcpy(&cpu, buf, sizeof(cpu));
+	return sizeof(cpu);
+}
+
 static uint16_t peek_get_cpu_reg(uintptr_t cpu_reg) {
 	enum cpu_reg reg = cpu_reg;
 	switch (reg) {
@@ -154,41 +179,66 @@ static uint16_t peek_get_cpu_reg(uintptr_t cpu_reg) {
 	}
 }
 
-void cpu_peek(struct peek *peek, struct peek_reply *reply) {
+int cpu_peek(struct peek *peek, struct peek_reply *reply) {
 	switch (peek->subtype) {
 		case CPU_PEEK_REG:
-			reply->size = sizeof(uint32_t);
-			reply->payload = malloc(reply->size); // caller frees
 			uint32_t cpu_reg = peek_get_cpu_reg(peek->req);
-			memcpy(reply->payload, &cpu_reg, reply->size);
-			break;
+			return peek_reply_put(reply, &cpu_reg, sizeof(cpu_reg));
 		case CPU_PEEK_ADDR:
-			reply->size = sizeof(uint32_t);
-			reply->payload = malloc(reply->size); // caller frees
-			uint32_t addr = monitor_rd_mem(peek->req);
-			memcpy(reply->payload, &addr, reply->size);
-			break;
+			uint8_t value = monitor_peek_mem(peek->req);
+			return peek_reply_put(reply, &value, sizeof(value));
 		case CPU_PEEK_INSTR_AT_ADDR:
 			{
-				uint32_t opcode = monitor_rd_mem(peek->req);
-				reply->size = opcode == OPCODE_PREFIX ? 2 : op_len[opcode];
-				reply->size *= sizeof(uint32_t);
-				reply->payload = malloc(reply->size); // caller frees
-				memcpy(reply->payload, &opcode, sizeof(uint32_t));
-				for (size_t i=1; i < (reply->size)/sizeof(uint32_t); i++) {
-					uint32_t req = monitor_rd_mem(peek->req+i);
-					memcpy((uint32_t*)reply->payload+i, &req, sizeof(uint32_t));
+				uint8_t instr[3];
+				instr[0] = monitor_peek_mem(peek->req);
+				size_t len = instr[0] == OPCODE_PREFIX ? 2 : op_len[instr[0]];
+				for (size_t i = 1; i < len; i++) {
+					instr[i] = monitor_peek_mem(peek->req+i);
 				}
+				return peek_reply_put(reply, instr, len);
 			}
-			break;
 		case CPU_PEEK_OP_LEN:
-			reply->size = sizeof(uint32_t);
-			reply->payload = malloc(reply->size); // caller frees
-			uint32_t len = op_len[peek->req];
-			memcpy(reply->payload, &len, sizeof(uint32_t));
-			break;
+			uint32_t len = op_len[peek->req & 0xff];
+			return peek_reply_put(reply, &len, sizeof(len));
+		case CPU_PEEK_MEM:
+			{
+				if (peek->req >= 0x10000 || peek->len > 0x10000 - peek->req) {
+					fprintf(stderr, "error: cpu_peek(): bad memory range\n");
+					return -1;
+				}
+				if (reply->size + peek->len > reply->capacity) {
+					fprintf(stderr, "error: cpu_peek(): reply too big\n");
+					return -1;
+				}
+				// a chunk at a time where memory is plain (as much of it as
+				// there is); io registers and such go through the usual reads,
+				// up to the end of the page.
+				uint8_t *dst = (uint8_t *)reply->payload + reply->size;
+				uint32_t addr = peek->req, end = peek->req + peek->len;
+				while (addr < end) {
+					size_t valid;
+					uint8_t *src = monitor_get_mem_ptr(addr, &valid);
+					uint32_t n;
+					if (src) {
+						n = valid < end - addr ? valid : end - addr;
+						memcpy(dst, src, n);
+					}
+					else {
+						uint32_t page_end = (addr | 0xff) + 1;
+						n = (page_end < end ? page_end : end) - addr;
+						for (uint32_t i = 0; i < n; i++) {
+							dst[i] = monitor_peek_mem(addr + i);
+						}
+					}
+					dst += n;
+					addr += n;
+				}
+				reply->size += peek->len;
+				return 0;
+			}
 		default:
 			fprintf(stderr, "error: cpu_peek()");
+			return -1;
 	}
 }
 
@@ -252,11 +302,11 @@ int cpu_exec_next() {
 
 	// fetch opcode
 	if (!cpu.state.is_halted) {
-		uint8_t op = monitor_rd_mem(REG_PC);
+		uint8_t op = monitor_fetch_mem(REG_PC);
 		//printf("EXECUTING %x\n", REG_PC);
 		REG_PC++;
 		if (op == OPCODE_PREFIX) {
-			op = monitor_rd_mem(REG_PC);
+			op = monitor_fetch_mem(REG_PC);
 			REG_PC++;
 			op_is_prefix = true;
 		}
@@ -45,6 +45,10 @@
 #define RD_WORD(addr) \
 	(monitor_rd_mem(addr) | monitor_rd_mem(addr+1)<<8)
 
+// instruction fetches (opcodes and immediates); see monitor_fetch_mem().
+#define FETCH_WORD(addr) \
+	(monitor_fetch_mem(addr) | monitor_fetch_mem(addr+1)<<8)
+
 #define WR_WORD(addr, value) \
 	monitor_wr_mem(addr, value&0xff); \
 	monitor_wr_mem(addr+1, (value&0xff00)>>8);
@@ -295,7 +295,7 @@ static int op_ld_a_a() {
 }
 
 #define OP_LD_REG16_MEM(reg, addr) \
-	uint16_t load = RD_WORD(addr); \
+	uint16_t load = FETCH_WORD(addr); \
 	DO_LD_REG(reg, load) \
 	ADVANCE_PC(2); \
 	return 3; \
@@ -360,7 +360,7 @@ static int op_ld_ind_hl_a() {
 }
 
 #define OP_LD_REG_MEM(reg, addr) \
-	uint8_t load = monitor_rd_mem(addr); \
+	uint8_t load = monitor_fetch_mem(addr); \
 	DO_LD_REG(reg, load) \
 	ADVANCE_PC(1); \
 	return 2; \
@@ -411,7 +411,7 @@ static int op_ld_a_ind_hl() {
 }
 
 static int op_ld_a_ind_a16() {
-	uint16_t addr = RD_WORD(REG_PC);
+	uint16_t addr = FETCH_WORD(REG_PC);
 	REG_A = monitor_rd_mem(addr);
 	ADVANCE_PC(2);
 	return 4;
@@ -478,26 +478,26 @@ static int op_ld_l_ind_hl() {
 
 // special snowflakes
 static int op_ld_ind_a16_sp() {
-	WR_WORD(RD_WORD(REG_PC), REG_SP);
+	WR_WORD(FETCH_WORD(REG_PC), REG_SP);
 	ADVANCE_PC(2);
 	return 5;
 }
 
 static int op_ld_ind_hl_n8() {
-	uint8_t load = monitor_rd_mem(REG_PC);
+	uint8_t load = monitor_fetch_mem(REG_PC);
 	monitor_wr_mem(REG_HL, load);
 	ADVANCE_PC(1);
 	return 3;
 }
 
 static int op_ld_ind_a16_a() {
-	monitor_wr_mem(RD_WORD(REG_PC), REG_A);
+	monitor_wr_mem(FETCH_WORD(REG_PC), REG_A);
 	ADVANCE_PC(2);
 	return 4;
 }
 
 static int op_ld_hl_sp_e8() {
-	int8_t load = monitor_rd_mem(REG_PC);
+	int8_t load = monitor_fetch_mem(REG_PC);
 	UNSET_FLAGS_ALL;
 	SET_FLAG(BOOL_TO_HALF_CARRY_FLAG(IS_ADD_HALF_CARRY(REG_SP, load)));
 	cpu.state.registers.hl = REG_SP+load;
@@ -517,7 +517,7 @@ static int op_ld_hl_sp_e8() {
 	return 1;
 
 static int op_ldh_ind_a8_a() {
-	uint16_t addr = monitor_rd_mem(REG_PC);
+	uint16_t addr = monitor_fetch_mem(REG_PC);
 	addr |= 0xff00;
 	monitor_wr_mem(addr, REG_A);
 	ADVANCE_PC(1);
@@ -530,7 +530,7 @@ static int op_ldh_ind_c_a() {
 }
 
 static int op_ldh_a_ind_a8() {
-	REG_A = monitor_rd_mem(0xff00+monitor_rd_mem(REG_PC));
+	REG_A = monitor_rd_mem(0xff00+monitor_fetch_mem(REG_PC));
 	ADVANCE_PC(1);
 	return 3;
 }
@@ -734,14 +734,14 @@ static int op_add_a_ind_hl() {
 }
 
 static int op_add_a_n8() {
-	int8_t load = monitor_rd_mem(REG_PC);
+	int8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_ADD(load, 0);
 	return 2;
 }
 
 static int op_add_sp_e8() {
-	int8_t load = monitor_rd_mem(REG_PC);
+	int8_t load = monitor_fetch_mem(REG_PC);
 	UNSET_FLAGS_ALL;
 	SET_FLAG(BOOL_TO_HALF_CARRY_FLAG(IS_ADD_HALF_CARRY(REG_SP, load)));
 	REG_SP += load;
@@ -812,7 +812,7 @@ static int op_adc_a_ind_hl() {
 }
 
 static int op_adc_a_n8() {
-	uint8_t word = monitor_rd_mem(REG_PC);
+	uint8_t word = monitor_fetch_mem(REG_PC);
 	bool carry = cpu.state.registers.f & FLAG_CARRY;
 	uint16_t sum = REG_A + word + carry;
 	UNSET_FLAGS_ALL;
@@ -875,7 +875,7 @@ static int op_sub_a_ind_hl() {
 }
 
 static int op_sub_a_n8() {
-	int8_t load = monitor_rd_mem(REG_PC);
+	int8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_SUB(load, 0);
 	return 2;
@@ -944,7 +944,7 @@ static int op_sbc_a_ind_hl() {
 }
 
 static int op_sbc_a_n8() {
-	uint8_t word = monitor_rd_mem(REG_PC);
+	uint8_t word = monitor_fetch_mem(REG_PC);
 	bool carry = cpu.state.registers.f & FLAG_CARRY;
 	uint16_t sum = REG_A - (word + carry);
 	UNSET_FLAGS_ALL;
@@ -2284,7 +2284,7 @@ static int op_and_a_ind_hl() {
 }
 
 static int op_and_a_n8() {
-	uint8_t load = monitor_rd_mem(REG_PC);
+	uint8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_AND(load);
 	return 2;
@@ -2330,7 +2330,7 @@ static int op_xor_a_ind_hl() {
 }
 
 static int op_xor_a_n8() {
-	uint8_t load = monitor_rd_mem(REG_PC);
+	uint8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_XOR(load);
 	return 2;
@@ -2380,7 +2380,7 @@ static int op_or_a_ind_hl() {
 }
 
 static int op_or_a_n8() {
-	uint8_t load = monitor_rd_mem(REG_PC);
+	uint8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_OR(load);
 	return 2;
@@ -2436,7 +2436,7 @@ static int op_cp_a_a() {
 }
 
 static int op_cp_a_n8() {
-	uint8_t load = monitor_rd_mem(REG_PC);
+	uint8_t load = monitor_fetch_mem(REG_PC);
 	ADVANCE_PC(1);
 	DO_CP(load);
 	return 2;
@@ -2449,13 +2449,13 @@ static int op_cp_a_n8() {
 	return 4;
 
 static int op_jmp_a16() {
-	uint16_t addr = RD_WORD(REG_PC);
+	uint16_t addr = FETCH_WORD(REG_PC);
 	DO_JMP(addr);
 }
 
 #define OP_JMP_COND(cond) \
 	if (cond) { \
-		uint16_t addr = RD_WORD(REG_PC); \
+		uint16_t addr = FETCH_WORD(REG_PC); \
 		DO_JMP(addr); \
 	} \
 	ADVANCE_PC(2); \
@@ -2488,13 +2488,13 @@ static int op_jmp_hl() {
 	return 3;
 
 static int op_jr_e8() {
-	int8_t off = monitor_rd_mem(REG_PC);
+	int8_t off = monitor_fetch_mem(REG_PC);
 	DO_JR(off);
 }
 
 #define OP_JR_COND(cond) \
 	if (cond) { \
-		int8_t off = monitor_rd_mem(REG_PC); \
+		int8_t off = monitor_fetch_mem(REG_PC); \
 		DO_JR(off); \
 	} \
 	ADVANCE_PC(1); \
@@ -2517,7 +2517,7 @@ static int op_jr_c_e8() {
 }
 
 #define DO_CALL() \
-	uint16_t addr = RD_WORD(REG_PC); \
+	uint16_t addr = FETCH_WORD(REG_PC); \
 	REG_PC +=2; \
 	REG_SP -= 2; \
 	WR_WORD(REG_SP, REG_PC); \
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "joypad.h"
+
+#include "cpu.h"
+#include "latency.h"
+#include "movie.h"
+#include "ppu.h"
+#include "rewind.h"
+
+struct joypad_event {
+	int64_t time;
+	uint8_t button;
+	bool is_pressed;
+};
+
+// ought to be plenty for a scanline's worth of input.
+#define QUEUE_SIZE 64
+#define QUEUE_MASK (QUEUE_SIZE-1)
+
+enum p1_bitmask {
+	P1_BITMASK_SELECT_DIRECTION = 0x10,
+	P1_BITMASK_SELECT_ACTION = 0x20
+};
+
+typedef struct {
+	// single producer (the input thread), single consumer (the emulation).
+	struct joypad_event queue[QUEUE_SIZE];
+	_Atomic uint32_t head; // written by the producer
+	_Atomic uint32_t tail; // written by the consumer
+
+	// only touched by the emulation.
+	uint8_t pressed;
+	uint8_t p1; // the select bits
+	// time of the input that changed 'pressed', until the game reads it.
+	int64_t unread_input_time;
+} joypad_t;
+static joypad_t joypad = { .p1 = P1_BITMASK_SELECT_DIRECTION | P1_BITMASK_SELECT_ACTION };
+
+void joypad_push_event(enum joypad_button button, bool is_pressed, int64_t time) {
+	uint32_t head = atomic_load_explicit(&joypad.head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&joypad.tail, memory_order_acquire) == QUEUE_SIZE) {
+		fprintf(stderr, "joypad_push_event(): queue full, event dropped\n");
+		return;
+	}
+	joypad.queue[head & QUEUE_MASK] = (struct joypad_event) {
+		.time = time,
+		.button = button,
+		.is_pressed = is_pressed
+	};
+	atomic_store_explicit(&joypad.head, head+1, memory_order_release);
+}
+
+// the low nibble of P1: the selected buttons, 0 meaning pressed.
+static uint8_t get_p1_lines() {
+	uint8_t lines = 0xf;
+	if (!(joypad.p1 & P1_BITMASK_SELECT_DIRECTION))
+		lines &= ~joypad.pressed & 0xf;
+	if (!(joypad.p1 & P1_BITMASK_SELECT_ACTION))
+		lines &= ~joypad.pressed >> 4;
+	return lines;
+}
+
+// the interrupt is requested when any of the P1 lines goes from high to low.
+static void update(uint8_t pressed, uint8_t p1) {
+	uint8_t lines = get_p1_lines();
+	joypad.pressed = pressed;
+	joypad.p1 = p1;
+	if (lines & ~get_p1_lines()) {
+		cpu_request_intr(REQUEST_INTR_JOYPAD);
+	}
+}
+
+void joypad_sync() {
+	// re-executing for the debugger; the input is what it was back then.
+	if (rewind_is_replaying()) {
+		uint8_t pressed = rewind_get_input();
+		if (pressed != joypad.pressed) {
+			update(pressed, joypad.p1);
+		}
+		return;
+	}
+
+	uint32_t tail = atomic_load_explicit(&joypad.tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&joypad.head, memory_order_acquire);
+
+	uint8_t pressed = joypad.pressed;
+	for (; tail != head; tail++) {
+		struct joypad_event *ev = &joypad.queue[tail & QUEUE_MASK];
+		uint8_t prev = pressed;
+		if (ev->is_pressed)
+			pressed |= ev->button;
+		else
+			pressed &= ~ev->button;
+		if (pressed != prev && !joypad.unread_input_time)
+			joypad.unread_input_time = ev->time;
+	}
+	atomic_store_explicit(&joypad.tail, tail, memory_order_release);
+
+	// a movie may be recording this, or overriding it.
+	pressed = movie_sync(pressed);
+	if (pressed != joypad.pressed) {
+		update(pressed, joypad.p1);
+	}
+}
+
+uint8_t joypad_get_state() {
+	return joypad.pressed;
+}
+
+uint8_t joypad_peek() {
+	return 0xc0 | joypad.p1 | get_p1_lines();
+}
+
+uint8_t joypad_rd() {
+	if (joypad.unread_input_time) {
+		latency_input_read(joypad.unread_input_time, ppu_get_frame_count());
+		joypad.unread_input_time = 0;
+	}
+	return joypad_peek();
+}
+
+void joypad_wr(uint8_t value) {
+	update(joypad.pressed, value & (P1_BITMASK_SELECT_DIRECTION | P1_BITMASK_SELECT_ACTION));
+}
+
+size_t joypad_save(uint8_t *buf) {
+	if (buf) {
+		buf[0] = joypad.pressed;
+		buf[1] = joypad.p1;
+	}
+	return 2;
+}
+
+size_t joypad_load(const uint8_t *buf) {
+	joypad.pressed = buf[0];
+	joypad.p1 = buf[1];
+	return 2;
+}
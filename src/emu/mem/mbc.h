@@ -19,6 +19,7 @@
 #ifndef MBC_H
 #define MBC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 // since each mbc variant implements different mechanisms for memory access (eg,
@@ -26,6 +27,14 @@
 typedef struct {
 	uint8_t (*rd_mem)(uint16_t addr);
 	void (*wr_mem)(uint16_t addr, uint8_t value);
+	// direct access to the memory backing 'addr', valid up to the end of
+	// its 0x100-byte page (and until the next bank switch).
+	uint8_t *(*get_mem_ptr)(uint16_t addr);
+	// the rom bank mapped at 0x4000-0x7fff.
+	uint16_t (*get_rom_bank)();
+	// snapshots of the cartridge state; like cpu_save() and cpu_load().
+	size_t (*save)(uint8_t *buf);
+	size_t (*load)(const uint8_t *buf);
 } mbc_iface_t;
 
 mbc_iface_t *mbc_init();
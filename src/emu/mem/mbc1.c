@@ -18,11 +18,13 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mbc.h"
 
 uint8_t mbc1_rom[0x8000+(0x4000*0x1f)]; // rom+ram
 static uint8_t mbc1_ram[0x2000*4]; // rom+ram
+static uint8_t rom_bank = 1;
 
 static void mbc1_wr_mem(uint16_t addr, uint8_t value) {
 	if (addr == 0xff50) {
@@ -39,6 +41,7 @@ static void mbc1_wr_mem(uint16_t addr, uint8_t value) {
 		if (value == 0)
 			value++;
 		value &= 0x1f;
+		rom_bank = value;
 		fseek(rom, 0x4000*value, SEEK_SET);
 		fread(mbc1_rom+0x4000, 1, 0x4000, rom);
 	}
@@ -50,8 +53,45 @@ static uint8_t mbc1_rd_mem(uint16_t addr) {
 	return mbc1_rom[addr];
 }
 
+static uint8_t *mbc1_get_mem_ptr(uint16_t addr) {
+	if (addr >= 0xa000 && addr <= 0xbfff)
+		return &mbc1_ram[addr-0xa000];
+	return &mbc1_rom[addr];
+}
+
+static uint16_t mbc1_get_rom_bank() {
+	return rom_bank;
+}
+
+// the banks currently mapped are part of the state, since they're copied into
+// the rom window on bank switches.
+#define MBC1_ROM_WINDOW 0x8000
+
+static size_t mbc1_save(uint8_t *buf) {
+	if (buf) {
+		memcpy(buf, mbc1_rom, MBC1_ROM_WINDOW);
+		memcpy(buf + MBC1_ROM_WINDOW, mbc1_ram, sizeof(mbc1_ram));
+		buf[MBC1_ROM_WINDOW + sizeof(mbc1_ram)] = rom_bank;
+	}
+	return MBC1_ROM_WINDOW + sizeof(mbc1_ram) + 1;
+}
+
+static size_t mbc1_load(const uint8_t *buf) {
+	memcpy(mbc1_rom, buf, MBC1_ROM_WINDOW);
+	memcpy(mbc1_ram, buf + MBC1_ROM_WINDOW, sizeof(mbc1_ram));
+	rom_bank = buf[MBC1_ROM_WINDOW + sizeof(mbc1_ram)];
+	return MBC1_ROM_WINDOW + sizeof(mbc1_ram) + 1;
+}
+
 // implement mbc_iface for mbc1
-mbc_iface_t mbc1_impl = { .rd_mem = mbc1_rd_mem, .wr_mem = mbc1_wr_mem };
+mbc_iface_t mbc1_impl = {
+	.rd_mem = mbc1_rd_mem,
+	.wr_mem = mbc1_wr_mem,
+	.get_mem_ptr = mbc1_get_mem_ptr,
+	.get_rom_bank = mbc1_get_rom_bank,
+	.save = mbc1_save,
+	.load = mbc1_load
+};
 
 void
 mbc1_mode(int val)
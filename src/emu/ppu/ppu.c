@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppu.h"
+
+#include "cpu.h"
+#include "monitor.h"
+
+#include "config.h"
+
+enum ppu_mode {
+	PPU_HBLANK=0,
+	PPU_VBLANK=1,
+	PPU_OAM=2,
+	PPU_DRAW=3
+};
+
+enum stat_interrupts {
+	STAT_INTR_HBLANK = 0b00001000,
+	STAT_INTR_VBLANK = 0b00010000,
+	STAT_INTR_OAM = 0b00100000,
+	STAT_INTR_LYLC = 0b01000000,
+};
+
+typedef struct {
+	struct ppu_state state;
+	enum ppu_mode mode;
+	enum ppu_raster_mode raster_mode;
+	int16_t dots_remaining;
+	uint64_t frame_count;
+	uint32_t vblank_dots;
+	// m-cycles left until the oam dma in progress ends.
+	uint16_t dma_cycles;
+
+	// bumped on every write that changes the rendered image (see ppu_wr()).
+	// if it didn't move during a frame nor during the previous one, the frame
+	// is the same as the previous one, and it isn't drawn at all.
+	uint64_t gen;
+	uint64_t frame_gen; // gen at the start of the frame
+	bool was_prev_frame_changed;
+	uint64_t skipped_frame_count;
+} ppu_t;
+ppu_t ppu;
+
+#define LY_LYC_FLAG 0x4
+static void check_ly_lyc() {
+	struct ppu_regs *regs = &ppu.state.regs;
+	if (regs->ly == regs->lyc) {
+		regs->stat |= LY_LYC_FLAG;
+		if (regs->stat & STAT_INTR_LYLC)
+			cpu_request_intr(REQUEST_INTR_LCD);
+	}
+	else {
+		regs->stat &= ~LY_LYC_FLAG;
+	}
+}
+
+static void set_ly(uint8_t value) {
+	ppu.state.regs.ly = value;
+	check_ly_lyc();
+}
+
+static void hblank_end_cycle() {
+	struct ppu_regs *regs = &ppu.state.regs;
+
+	set_ly(regs->ly+1);
+
+	// change to vblank phase if the rendering line is >= 144.
+	// else change to oam phase.
+	if (regs->ly >= 144) {
+		ppu.vblank_dots = 0;
+		ppu.dots_remaining += DOTS_VBLANK;
+		ppu.mode = PPU_VBLANK;
+		regs->stat |= 1;
+		if (regs->stat & STAT_INTR_VBLANK) {
+			cpu_request_intr(REQUEST_INTR_LCD);
+		}
+		cpu_request_intr(REQUEST_INTR_VBLANK);
+	}
+	else {
+		ppu.dots_remaining += DOTS_OAM;
+		ppu.mode = PPU_OAM;
+		regs->stat |= 2;
+		if (regs->stat & STAT_INTR_OAM) {
+			cpu_request_intr(REQUEST_INTR_LCD);
+		}
+	}
+}
+
+static void vblank_end_cycle() {
+	struct ppu_regs *regs = &ppu.state.regs;
+	ppu.dots_remaining += DOTS_OAM;
+	set_ly(0);
+	ppu.mode = PPU_OAM;
+	regs->stat &= ~3;
+	regs->stat |= 2;
+
+	ppu.frame_count++;
+	monitor_end_frame();
+}
+
+// the dot we're at, counting from the beginning of the frame.
+static uint32_t get_frame_dot() {
+	int line_dot;
+	switch (ppu.mode) {
+		case PPU_OAM:
+			line_dot = DOTS_OAM - ppu.dots_remaining;
+			break;
+		case PPU_DRAW:
+			line_dot = DOTS_OAM + DOTS_DRAW - ppu.dots_remaining;
+			break;
+		case PPU_HBLANK:
+			line_dot = DOTS_LINE - ppu.dots_remaining;
+			break;
+		case PPU_VBLANK:
+		default:
+			return SCREEN_LINES*DOTS_LINE + DOTS_VBLANK - ppu.dots_remaining;
+	}
+	return ppu.state.regs.ly*DOTS_LINE + line_dot;
+}
+
+// whether the frame so far is the same as the previous one.
+static bool is_frame_unchanged() {
+	return !ppu.was_prev_frame_changed && ppu.gen == ppu.frame_gen;
+}
+
+static void end_frame() {
+	if (is_frame_unchanged()) {
+		ppu.skipped_frame_count++;
+	}
+	else {
+		raster_log_frame(ppu.frame_count);
+		if (ppu.raster_mode != PPU_RASTER_THREAD) {
+			raster_run();
+		}
+	}
+	ppu.was_prev_frame_changed = ppu.gen != ppu.frame_gen;
+	ppu.frame_gen = ppu.gen;
+}
+
+static void change_phase() {
+	switch (ppu.mode) {
+		// hblank cycle
+		case PPU_HBLANK:
+			hblank_end_cycle();
+			break;
+		case PPU_VBLANK:
+			end_frame();
+			vblank_end_cycle();
+			break;
+		case PPU_OAM:
+			ppu.dots_remaining += DOTS_DRAW;
+			ppu.state.regs.stat |= 3;
+			ppu.mode = PPU_DRAW;
+			break;
+		case PPU_DRAW:
+			// while nothing changes, the rasterizer can stay behind; the
+			// next write makes it catch up with the same state.
+			if (ppu.raster_mode == PPU_RASTER_LINE && !is_frame_unchanged()) {
+				raster_log_sync(get_frame_dot());
+				raster_run();
+			}
+			ppu.dots_remaining += DOTS_HBLANK;
+			ppu.state.regs.stat &= ~3;
+			ppu.mode = PPU_HBLANK;
+			break;
+		default:
+	}
+}
+
+void ppu_set_raster_mode(enum ppu_raster_mode mode) {
+	ppu.raster_mode = mode;
+}
+
+void ppu_fini() {
+	raster_stop_thread();
+}
+
+int ppu_init() {
+	if (ppu.raster_mode == PPU_RASTER_THREAD) {
+		return raster_start_thread();
+	}
+	return 0;
+}
+
+uint64_t ppu_get_frame_count() {
+	return ppu.frame_count;
+}
+
+uint64_t ppu_get_skipped_frame_count() {
+	return ppu.skipped_frame_count;
+}
+
+static void ppu_reset() {
+	ppu.dots_remaining = DOTS_OAM;
+	ppu.mode = PPU_OAM;
+	ppu.state.regs.ly = 0;
+	raster_log_reset();
+}
+
+#define OAM_SIZE 0xa0
+// an oam dma takes one m-cycle per byte.
+#define DMA_CYCLES OAM_SIZE
+
+// copy 0xa0 bytes from 'page'*0x100 to oam.
+// the whole transfer is done at once; then, for as long as the real one
+// would last, the cpu is locked out of oam (see ppu_rd() and ppu_wr()).
+static void dma(uint8_t page) {
+	uint16_t src_addr = page*0x100;
+	size_t len;
+	uint8_t *src = monitor_get_mem_ptr(src_addr, &len);
+	uint8_t buf[OAM_SIZE];
+	if (!src || len < OAM_SIZE) {
+		// not plain memory (eg, io registers).
+		for (int i = 0; i < OAM_SIZE; i++)
+			buf[i] = monitor_rd_mem(src_addr+i);
+		src = buf;
+	}
+	// games usually copy their shadow oam every frame, changed or not.
+	if (memcmp(ppu.state.oam, src, OAM_SIZE)) {
+		memcpy(ppu.state.oam, src, OAM_SIZE);
+		raster_log_wr_range(get_frame_dot(), 0xfe00, ppu.state.oam, OAM_SIZE);
+		ppu.gen++;
+	}
+	ppu.dma_cycles = DMA_CYCLES;
+}
+
+static void wr_reg(uint16_t addr, uint8_t value) {
+	struct ppu_regs *regs = &ppu.state.regs;
+
+	switch (addr) {
+		case 0xff40:
+			// turn on/off ppu
+			if ((regs->lcdc & 0x80) != (value & 0x80)) {
+				ppu_reset();
+				if (!(value & 0x80))
+					regs->stat &= ~3;
+			}
+			regs->lcdc = value;
+			break;
+		case 0xff41:
+			regs->stat = value;
+			break;
+		case 0xff42:
+			regs->scy = value;
+			break;
+		case 0xff43:
+			regs->scx = value;
+			break;
+		case 0xff44:
+			regs->ly = value;
+			break;
+		case 0xff45:
+			regs->lyc = value;
+			break;
+		case 0xff46:
+			regs->dma = value;
+			dma(value);
+			break;
+		case 0xff47:
+			regs->bgp = value;
+			break;
+		case 0xff48:
+			regs->obp0 = value;
+			break;
+		case 0xff49:
+			regs->obp1 = value;
+			break;
+		case 0xff4a:
+			regs->wy = value;
+			break;
+		case 0xff4b:
+			regs->wx = value;
+			break;
+		default:
+			fprintf(stderr, "error: ppu_wd_reg()");
+	}
+}
+
+void ppu_state_wr(struct ppu_state *state, uint16_t addr, uint8_t value) {
+	struct ppu_regs *regs = &state->regs;
+
+	if (addr >= 0x8000 && addr <= 0x97ff) {
+		state->tile_data[addr-0x8000] = value;
+	}
+	else if (addr >= 0x9800 && addr <= 0x9bff) {
+		state->tile_map1[addr-0x9800] = value;
+	}
+	else if (addr >= 0x9c00 && addr <= 0x9fff) {
+		state->tile_map2[addr-0x9c00] = value;
+	}
+	else if (addr >= 0xfe00 && addr <= 0xfe9f) {
+		state->oam[addr-0xfe00] = value;
+	}
+	else {
+		switch (addr) {
+			case 0xff40:
+				regs->lcdc = value;
+				break;
+			case 0xff42:
+				regs->scy = value;
+				break;
+			case 0xff43:
+				regs->scx = value;
+				break;
+			case 0xff47:
+				regs->bgp = value;
+				break;
+			case 0xff48:
+				regs->obp0 = value;
+				break;
+			case 0xff49:
+				regs->obp1 = value;
+				break;
+			case 0xff4a:
+				regs->wy = value;
+				break;
+			case 0xff4b:
+				regs->wx = value;
+				break;
+			default:
+				fprintf(stderr, "error: ppu_state_wr()");
+		}
+	}
+}
+
+// whether a write to 'addr' changes the rendered image.
+static bool is_raster_addr(uint16_t addr) {
+	switch (addr) {
+		case 0xff41:
+		case 0xff44:
+		case 0xff45:
+		case 0xff46:
+			return false;
+		default:
+			return true;
+	}
+}
+
+void ppu_wr(uint16_t addr, uint8_t value) {
+	if (ppu.dma_cycles && addr >= 0xfe00 && addr <= 0xfe9f) {
+		// the dma owns the oam bus.
+		return;
+	}
+
+	// writing what's already there doesn't change the image.
+	bool is_change = is_raster_addr(addr) && ppu_rd(addr) != value;
+
+	if (addr >= 0xff40) {
+		wr_reg(addr, value);
+	}
+	else if ((addr >= 0x8000 && addr <= 0x9fff) ||
+			(addr >= 0xfe00 && addr <= 0xfe9f)) {
+		ppu_state_wr(&ppu.state, addr, value);
+	}
+	else {
+		fprintf(stderr, "error: ppu_wr()");
+		return;
+	}
+
+	if (is_change) {
+		raster_log_wr(get_frame_dot(), addr, value);
+		ppu.gen++;
+	}
+}
+
+static uint8_t rd_reg(uint16_t addr) {
+	struct ppu_regs *regs = &ppu.state.regs;
+
+	switch (addr) {
+		case 0xff40:
+			return regs->lcdc;
+		case 0xff41:
+			return regs->stat;
+		case 0xff42:
+			return regs->scy;
+		case 0xff43:
+			return regs->scx;
+		case 0xff44:
+			return regs->ly;
+		case 0xff45:
+			return regs->lyc;
+		case 0xff46:
+			return regs->dma;
+		case 0xff47:
+			return regs->bgp;
+		case 0xff48:
+			return regs->obp0;
+		case 0xff49:
+			return regs->obp1;
+		case 0xff4a:
+			return regs->wy;
+		case 0xff4b:
+			return regs->wx;
+		default:
+			fprintf(stderr, "error: rd_reg()");
+			return 0;
+	}
+}
+
+uint8_t ppu_rd(uint16_t addr) {
+	if (ppu.dma_cycles && addr >= 0xfe00 && addr <= 0xfe9f) {
+		return 0xff;
+	}
+
+	if (addr >= 0xff40) {
+		return rd_reg(addr);
+	}
+	else if (addr >= 0x8000 && addr <= 0x97ff) {
+		return ppu.state.tile_data[addr-0x8000];
+	}
+	else if (addr >= 0x9800 && addr <= 0x9bff) {
+		return ppu.state.tile_map1[addr-0x9800];
+	}
+	else if (addr >= 0x9c00 && addr <= 0x9fff) {
+		return ppu.state.tile_map2[addr-0x9c00];
+	}
+	else if (addr >= 0xfe00 && addr <= 0xfe9f) {
+		return ppu.state.oam[addr-0xfe00];
+	}
+	else {
+		fprintf(stderr, "error: ppu_rd()");
+		return 0;
+	}
+}
+
+uint8_t *ppu_get_mem_ptr(uint16_t addr) {
+	if (addr >= 0x8000 && addr <= 0x97ff) {
+		return &ppu.state.tile_data[addr-0x8000];
+	}
+	else if (addr >= 0x9800 && addr <= 0x9bff) {
+		return &ppu.state.tile_map1[addr-0x9800];
+	}
+	else if (addr >= 0x9c00 && addr <= 0x9fff) {
+		return &ppu.state.tile_map2[addr-0x9c00];
+	}
+	else if (addr >= 0xfe00 && addr <= 0xfe9f) {
+		return &ppu.state.oam[addr-0xfe00];
+	}
+	return nullptr;
+}
+
+void ppu_refresh(uint8_t ticks) {
+	// the dma runs whether the lcd is on or not.
+	if (ppu.dma_cycles) {
+		ppu.dma_cycles = ticks >= ppu.dma_cycles ? 0 : ppu.dma_cycles - ticks;
+	}
+
+	if (!(ppu.state.regs.lcdc & LCDC_BITMASK_PPU_ENABLE)) {
+		return;
+	}
+
+	if (!ticks) {
+		if (ppu.mode != PPU_VBLANK) {
+			ppu.dots_remaining = 12;
+		}
+		ticks = 3;
+	}
+
+	ppu.dots_remaining -= CYCLES_TO_DOTS(ticks);
+	if (ppu.dots_remaining <= 0 || ppu.state.regs.ly == 0x99) {
+		change_phase();
+		return;
+	}
+	if (ppu.mode == PPU_VBLANK) {
+		ppu.vblank_dots += CYCLES_TO_DOTS(ticks);
+		if (ppu.vblank_dots / DOTS_VBLANK_LINE) {
+			set_ly(ppu.state.regs.ly+1);
+			ppu.vblank_dots = ppu.vblank_dots % DOTS_VBLANK_LINE;
+		}
+	}
+}
+
+// what a snapshot has; the rest is configuration or statistics.
+struct ppu_snapshot {
+	struct ppu_state state;
+	enum ppu_mode mode;
+	int16_t dots_remaining;
+	uint64_t frame_count;
+	uint32_t vblank_dots;
+	uint16_t dma_cycles;
+};
+
+size_t ppu_save(uint8_t *buf) {
+	if (buf) {
+		// the padding is zeroed too; snapshots get hashed (see movie.c).
+		struct ppu_snapshot snapshot = {};
+		snapshot.state = ppu.state;
+		snapshot.mode = ppu.mode;
+		snapshot.dots_remaining = ppu.dots_remaining;
+		snapshot.frame_count = ppu.frame_count;
+		snapshot.vblank_dots = ppu.vblank_dots;
+		snapshot.dma_cycles = ppu.dma_cycles;
+		memcpy(buf, &snapshot, sizeof(snapshot));
+	}
+	return sizeof(struct ppu_snapshot);
+}
+
+size_t ppu_load(const uint8_t *buf) {
+	struct ppu_snapshot snapshot;
+	memcpy(&snapshot, buf, sizeof(snapshot));
+	ppu.state = snapshot.state;
+	ppu.mode = snapshot.mode;
+	ppu.dots_remaining = snapshot.dots_remaining;
+	ppu.frame_count = snapshot.frame_count;
+	ppu.vblank_dots = snapshot.vblank_dots;
+	ppu.dma_cycles = snapshot.dma_cycles;
+
+	// bring the rasterizer up to date through the log, as the rasterizer
+	// may be running in a thread of its own.
+	struct ppu_state *state = &ppu.state;
+	raster_log_reset();
+	raster_log_wr_range(0, 0x8000, state->tile_data, sizeof(state->tile_data));
+	raster_log_wr_range(0, 0x9800, state->tile_map1, sizeof(state->tile_map1));
+	raster_log_wr_range(0, 0x9c00, state->tile_map2, sizeof(state->tile_map2));
+	raster_log_wr_range(0, 0xfe00, state->oam, OAM_SIZE);
+	static const uint16_t raster_regs[] = {
+		0xff40, 0xff42, 0xff43, 0xff47, 0xff48, 0xff49, 0xff4a, 0xff4b
+	};
+	for (size_t i = 0; i < sizeof(raster_regs)/sizeof(raster_regs[0]); i++) {
+		raster_log_wr(0, raster_regs[i], rd_reg(raster_regs[i]));
+	}
+	// and don't take the next frame for an unchanged one.
+	ppu.was_prev_frame_changed = true;
+	ppu.frame_gen = ppu.gen;
+
+	return sizeof(snapshot);
+}
+
+static uint16_t peek_get_ppu_reg(uintptr_t ppu_reg) {
+	enum ppu_reg reg = ppu_reg;
+	switch (reg) {
+		case PPU_REG_LY:
+			return ppu_rd(0xff44);
+		default:
+			fprintf(stderr, "error: peek_get_ppu_reg()");
+			return -1;
+	}
+}
+
+int ppu_peek(struct peek *peek, struct peek_reply *reply) {
+	switch (peek->subtype) {
+		case PPU_PEEK_REG:
+			uint32_t ppu_reg = peek_get_ppu_reg(peek->req);
+			return peek_reply_put(reply, &ppu_reg, sizeof(ppu_reg));
+		default:
+			fprintf(stderr, "error: ppu_peek()");
+			return -1;
+	}
+}
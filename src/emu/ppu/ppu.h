@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdint.h>
+
+#include "../include/ppu.h"
+
+#define DOTS_DRAW 230
+#define DOTS_HBLANK 145
+#define DOTS_OAM 80
+#define DOTS_VBLANK 4560
+#define DOTS_LINE (DOTS_OAM+DOTS_DRAW+DOTS_HBLANK)
+// vblank starts at ly==144.
+// ly goes from 144 to 152 in the whole
+// duration of the vblank.
+#define DOTS_VBLANK_LINE (4560/10)
+#define CYCLES_TO_DOTS(cycles) cycles<<2;
+
+#define SCANLINE 160
+#define SCREEN_LINES 144
+
+enum ppu_lcdc_bitmask {
+	LCDC_BITMASK_BG_ENABLE = 1,
+	LCDC_BITMASK_OBJ_ENABLE = 1 << 1,
+	LCDC_BITMASK_OBJ_SIZE = 1 << 2,
+	LCDC_BITMASK_BG_TILE_MAP = 1 << 3,
+	LCDC_BITMASK_BGWIN_TILE_DATA = 1 << 4,
+	LCDC_BITMASK_WIN_ENABLE = 1 << 5,
+	LCDC_BITMASK_WIN_TILE_MAP = 1 << 6,
+	LCDC_BITMASK_PPU_ENABLE = 1 << 7
+};
+
+struct ppu_regs {
+	uint8_t lcdc;
+	uint8_t ly;
+	uint8_t lyc;
+	uint8_t stat;
+	uint8_t scx;
+	uint8_t scy;
+	uint8_t dma;
+	uint8_t bgp;
+	uint8_t obp0;
+	uint8_t obp1;
+	uint8_t wx;
+	uint8_t wy;
+};
+
+// everything that is needed to draw a scanline.
+// the ppu owns the live copy; the rasterizer keeps its own copy, which it
+// brings up to date by replaying the write log (see raster.c).
+struct ppu_state {
+	struct ppu_regs regs;
+	uint8_t tile_data[0x1800]; // address space range 0x8000-0x97ff
+	uint8_t tile_map1[0x400]; // address space range 0x9800-0x9bff
+	uint8_t tile_map2[0x400]; // address space range 0x9c00-0x9fff
+	uint8_t oam[0x100]; // address space range 0xfe00-0xfe9f
+};
+
+// store a value in the state, without any of the side effects that
+// writing to the ppu has (eg, turning on/off the lcd).
+void ppu_state_wr(struct ppu_state *state, uint16_t addr, uint8_t value);
+
+// the write log.
+// the ppu logs every write that affects the rendered image, timestamped with
+// the dot (relative to the beginning of the frame) at which it happened.
+// the rasterizer replays the log, drawing the pixels in between writes with
+// the state as it was at that dot, so that mid-frame effects (eg, wavy scroll,
+// palette swaps) come out right regardless of when the rasterizer runs.
+void raster_log_wr(uint32_t dot, uint16_t addr, uint8_t value);
+// 'len' consecutive writes at once, starting at 'addr' (eg, an oam dma).
+void raster_log_wr_range(uint32_t dot, uint16_t addr, const uint8_t *values, uint16_t len);
+// the rasterizer should draw everything up to 'dot'.
+void raster_log_sync(uint32_t dot);
+// frame number 'frame' is complete; it can be handed to the display.
+void raster_log_frame(uint32_t frame);
+// the lcd was turned on/off; the current frame is abandoned.
+void raster_log_reset();
+
+// replay everything logged so far.
+void raster_run();
+
+// in PPU_RASTER_THREAD mode, the log is replayed by a thread of its own,
+// which is woken up on every complete frame.
+int raster_start_thread();
+void raster_stop_thread();
+
+#endif
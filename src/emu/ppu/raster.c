@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ppu.h"
+
+#include "render.h"
+
+enum log_entry_type {
+	LOG_WR,
+	LOG_SYNC,
+	LOG_FRAME,
+	LOG_RESET
+};
+
+struct log_entry {
+	uint32_t dot;
+	uint16_t addr;
+	uint8_t value;
+	uint8_t type;
+};
+
+// a frame that rewrites the whole of vram and oam is ~8k writes, plus the
+// register writes; make room for a few of those before having to drain.
+#define LOG_SIZE (1<<15)
+#define LOG_MASK (LOG_SIZE-1)
+
+#define MAX_OBJS_PER_LINE 10
+
+#define NUM_TILES 384 // 0x1800 bytes of tile data, 16 bytes each
+
+// each tile map, drawn as a 256x256 bitmap of color indices (0-3).
+// tiles are drawn lazily, the first time a line needs them after they
+// changed; a tile is stale if its map entry now points to another tile (be it
+// because of a write to the map or to the lcdc addressing mode), or if the
+// tile data it was drawn from changed since.
+struct tilemap_cache {
+	uint8_t bitmap[256][256];
+	struct {
+		uint16_t tile; // index into the tile data, in tiles
+		uint32_t gen; // tile_gen[tile] when it was drawn
+		bool is_valid;
+	} entries[0x400];
+};
+
+typedef struct {
+	// the state as of the dot the rasterizer is at.
+	struct ppu_state state;
+
+	// where we are in the frame.
+	uint8_t line;
+	uint8_t x;
+
+	// objects selected for the current line, in oam order.
+	uint8_t *objs[MAX_OBJS_PER_LINE];
+	int num_objs;
+
+	// bumped on every write to a tile's data.
+	uint32_t tile_gen[NUM_TILES];
+	struct tilemap_cache tilemap_caches[2]; // tile_map1, tile_map2
+
+	// single producer (the ppu), single consumer (the rasterizer).
+	// in PPU_RASTER_THREAD mode they run on different threads.
+	struct log_entry log[LOG_SIZE];
+	_Atomic uint32_t head; // written by the ppu
+	_Atomic uint32_t tail; // written by the rasterizer
+
+	bool threaded;
+	pthread_t thread;
+	sem_t wakeup;
+	atomic_bool quit;
+	// the ppu waits on 'space' while the log is full.
+	sem_t space;
+	atomic_bool is_ppu_waiting;
+} raster_t;
+static raster_t raster;
+
+#define OBJ_ATTR_PRIORITY 0x80
+#define OBJ_ATTR_FLIP_Y 0x40
+#define OBJ_ATTR_FLIP_X 0x20
+#define OBJ_ATTR_PALETTE 0x10
+
+// the tile a tile map entry points to, as per the current addressing mode.
+static uint16_t get_tile(uint8_t tile_indx) {
+	if (raster.state.regs.lcdc & LCDC_BITMASK_BGWIN_TILE_DATA)
+		return tile_indx;
+	return 256 + (int8_t)tile_indx;
+}
+
+static uint16_t get_tile_line_from_object(uint8_t *obj, uint8_t line) {
+	uint8_t *tiledata = raster.state.tile_data;
+	tiledata += obj[2] * 16;
+
+	uint8_t size_obj = (raster.state.regs.lcdc & LCDC_BITMASK_OBJ_SIZE ? 16 : 8);
+	tiledata += obj[3] & OBJ_ATTR_FLIP_Y ? ((size_obj-1) - line) * 2 : line * 2;
+
+	return *(uint16_t *)tiledata;
+}
+
+// the color index (0-3) of pixel 'x' in a tile line.
+static uint8_t get_color_indx(uint16_t tileline, uint8_t x) {
+	uint8_t indx = (bool)(tileline & (0x8000 >> (x&7)))<<1;
+	indx |= (bool)(tileline & (0x80 >> (x&7)));
+	return indx;
+}
+
+// like the oam scan phase, select the (up to 10) objects on the current line.
+static void select_objs() {
+	uint8_t size = raster.state.regs.lcdc & LCDC_BITMASK_OBJ_SIZE ? 16 : 8;
+	uint8_t *obj = raster.state.oam;
+
+	raster.num_objs = 0;
+	for (int i = 0; i < 40 && raster.num_objs < MAX_OBJS_PER_LINE; i++, obj += 4) {
+		if ((uint8_t)((raster.line+16) - obj[0]) < size) {
+			raster.objs[raster.num_objs++] = obj;
+		}
+	}
+}
+
+// the object pixel at 'x', if any.
+// among overlapping objects, the one with the smaller x coordinate wins; for
+// equal x coordinates, the one first in oam wins.
+static uint8_t get_obj_pixel(int x, uint8_t **out_obj) {
+	uint8_t size = raster.state.regs.lcdc & LCDC_BITMASK_OBJ_SIZE ? 16 : 8;
+	uint8_t pixel = 0;
+	*out_obj = nullptr;
+	for (int i = 0; i < raster.num_objs; i++) {
+		uint8_t *obj = raster.objs[i];
+		// oam may have been written since the objects were selected.
+		uint8_t obj_line = (raster.line+16) - obj[0];
+		if (obj_line >= size) {
+			continue;
+		}
+		uint8_t pixel_in_tile = (x+8) - obj[1];
+		if (pixel_in_tile >= 8) {
+			continue;
+		}
+		if (*out_obj && obj[1] >= (*out_obj)[1]) {
+			continue;
+		}
+
+		uint16_t tileline = get_tile_line_from_object(obj, obj_line);
+		if (obj[3] & OBJ_ATTR_FLIP_X) {
+			pixel_in_tile = 7 - pixel_in_tile;
+		}
+		uint8_t indx = get_color_indx(tileline, pixel_in_tile);
+		if (indx) {
+			pixel = indx;
+			*out_obj = obj;
+		}
+	}
+	return pixel;
+}
+
+static void draw_tile(struct tilemap_cache *cache, uint16_t entry, uint16_t tile) {
+	const uint8_t *tiledata = &raster.state.tile_data[tile*16];
+	uint8_t x0 = (entry & 31) * 8;
+	uint8_t y0 = (entry >> 5) * 8;
+	for (int y = 0; y < 8; y++) {
+		uint16_t tileline = *(uint16_t *)&tiledata[y*2];
+		uint8_t *row = &cache->bitmap[y0+y][x0];
+		for (int x = 0; x < 8; x++) {
+			row[x] = get_color_indx(tileline, x);
+		}
+	}
+
+	cache->entries[entry].tile = tile;
+	cache->entries[entry].gen = raster.tile_gen[tile];
+	cache->entries[entry].is_valid = true;
+}
+
+// copy 'len' color indices of line 'y' of a tile map, starting at 'x' and
+// wrapping around the end of the line, redrawing any stale tiles first.
+static void copy_tilemap_line(uint8_t *dst, bool is_map2, uint8_t y, uint8_t x, int len) {
+	struct tilemap_cache *cache = &raster.tilemap_caches[is_map2];
+	const uint8_t *map = is_map2 ? raster.state.tile_map2 : raster.state.tile_map1;
+
+	int num_tiles = ((x&7) + len + 7) >> 3;
+	for (int i = 0; i < num_tiles; i++) {
+		uint16_t entry = (y>>3)<<5 | (((x>>3) + i) & 31);
+		uint16_t tile = get_tile(map[entry]);
+		if (!cache->entries[entry].is_valid || cache->entries[entry].tile != tile ||
+				cache->entries[entry].gen != raster.tile_gen[tile]) {
+			draw_tile(cache, entry, tile);
+		}
+	}
+
+	const uint8_t *line = cache->bitmap[y];
+	int first = len < 256 - x ? len : 256 - x;
+	memcpy(dst, &line[x], first);
+	memcpy(dst + first, line, len - first);
+}
+
+static uint8_t get_pal_shade(uint8_t palette, uint8_t indx) {
+	assert(indx <= 3);
+	return (palette >> (indx<<1)) & 3;
+}
+
+// draw pixels [x0, x1) of the current line.
+static void draw_span(int x0, int x1) {
+	struct ppu_regs *regs = &raster.state.regs;
+	uint8_t ly = raster.line;
+
+	if (x0 == 0) {
+		select_objs();
+	}
+
+	// the color indices of the background, or the window where it covers it.
+	uint8_t bgwin_line[SCANLINE];
+	bool is_bg = regs->lcdc & LCDC_BITMASK_BG_ENABLE;
+	int win_x0 = x1; // where the window starts
+	if (regs->lcdc & LCDC_BITMASK_WIN_ENABLE &&
+			regs->wy <= ly && regs->wx < 166 && regs->wy < 143) {
+		win_x0 = regs->wx < 7 ? 0 : regs->wx - 7;
+		if (win_x0 < x0)
+			win_x0 = x0;
+		if (win_x0 > x1)
+			win_x0 = x1;
+	}
+	if (is_bg && x0 < win_x0) {
+		copy_tilemap_line(&bgwin_line[x0], regs->lcdc & LCDC_BITMASK_BG_TILE_MAP,
+			ly + regs->scy, x0 + regs->scx, win_x0 - x0);
+	}
+	if (win_x0 < x1) {
+		copy_tilemap_line(&bgwin_line[win_x0], regs->lcdc & LCDC_BITMASK_WIN_TILE_MAP,
+			ly - regs->wy, win_x0 + 7 - regs->wx, x1 - win_x0);
+	}
+
+	for (int x = x0; x < x1; x++) {
+		uint8_t final_pixel = 0;
+
+		uint8_t *obj_prio = nullptr;
+		uint8_t obj_indx = 0;
+		if (regs->lcdc & LCDC_BITMASK_OBJ_ENABLE) {
+			obj_indx = get_obj_pixel(x, &obj_prio);
+			if (obj_indx) {
+				uint8_t obj_palette = obj_prio[3] & OBJ_ATTR_PALETTE ? regs->obp1 : regs->obp0;
+				final_pixel = get_pal_shade(obj_palette, obj_indx);
+			}
+		}
+
+		if ((is_bg || x >= win_x0) &&
+				(!obj_indx || obj_prio[3] & OBJ_ATTR_PRIORITY)) {
+			uint8_t bgwin_indx = bgwin_line[x];
+			if (!obj_indx || bgwin_indx != 0)
+				final_pixel = get_pal_shade(regs->bgp, bgwin_indx);
+		}
+		render_draw_pixel(x, ly, final_pixel);
+	}
+}
+
+// draw everything up to 'dot', with the current state.
+static void advance_to(uint32_t dot) {
+	uint32_t line = dot / DOTS_LINE;
+	int x = (int)(dot % DOTS_LINE) - DOTS_OAM;
+	if (x < 0)
+		x = 0;
+	if (x > SCANLINE)
+		x = SCANLINE;
+
+	if (line >= SCREEN_LINES) {
+		line = SCREEN_LINES;
+		x = 0;
+	}
+
+	while (raster.line < line) {
+		if (raster.x < SCANLINE)
+			draw_span(raster.x, SCANLINE);
+		raster.line++;
+		raster.x = 0;
+	}
+	if (raster.line < SCREEN_LINES && raster.x < x) {
+		draw_span(raster.x, x);
+		raster.x = x;
+	}
+}
+
+// wait until there's room for 'n' entries in the log, and return the head.
+static uint32_t log_reserve(uint32_t n) {
+	uint32_t head = atomic_load_explicit(&raster.head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&raster.tail, memory_order_acquire) > LOG_SIZE - n) {
+		if (raster.threaded) {
+			// the log is full; let the rasterizer catch up.
+			// the flag goes up before checking again, so that either we see
+			// the room it made or it sees us waiting (see raster_run()).
+			sem_post(&raster.wakeup);
+			atomic_store_explicit(&raster.is_ppu_waiting, true, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			if (head - atomic_load_explicit(&raster.tail, memory_order_relaxed) > LOG_SIZE - n) {
+				sem_wait(&raster.space);
+			}
+		}
+		else {
+			// the log is full; the ppu and the rasterizer run on the same
+			// thread, so just catch up.
+			raster_run();
+		}
+	}
+	return head;
+}
+
+static void log_push(enum log_entry_type type, uint32_t dot, uint16_t addr, uint8_t value) {
+	uint32_t head = log_reserve(1);
+	raster.log[head & LOG_MASK] = (struct log_entry) {
+		.dot = dot,
+		.addr = addr,
+		.value = value,
+		.type = type
+	};
+	atomic_store_explicit(&raster.head, head+1, memory_order_release);
+}
+
+void raster_log_wr(uint32_t dot, uint16_t addr, uint8_t value) {
+	log_push(LOG_WR, dot, addr, value);
+}
+
+void raster_log_wr_range(uint32_t dot, uint16_t addr, const uint8_t *values, uint16_t len) {
+	uint32_t head = log_reserve(len);
+	for (uint16_t i = 0; i < len; i++) {
+		raster.log[(head+i) & LOG_MASK] = (struct log_entry) {
+			.dot = dot,
+			.addr = addr+i,
+			.value = values[i],
+			.type = LOG_WR
+		};
+	}
+	atomic_store_explicit(&raster.head, head+len, memory_order_release);
+}
+
+void raster_log_sync(uint32_t dot) {
+	log_push(LOG_SYNC, dot, 0, 0);
+}
+
+void raster_log_frame(uint32_t frame) {
+	// no dot for this one; it carries the frame number instead.
+	log_push(LOG_FRAME, frame, 0, 0);
+	if (raster.threaded) {
+		sem_post(&raster.wakeup);
+	}
+}
+
+void raster_log_reset() {
+	log_push(LOG_RESET, 0, 0, 0);
+}
+
+void raster_run() {
+	uint32_t tail = atomic_load_explicit(&raster.tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&raster.head, memory_order_acquire);
+	while (tail != head) {
+		struct log_entry *entry = &raster.log[tail & LOG_MASK];
+		switch (entry->type) {
+			case LOG_WR:
+				advance_to(entry->dot);
+				ppu_state_wr(&raster.state, entry->addr, entry->value);
+				if (entry->addr >= 0x8000 && entry->addr <= 0x97ff) {
+					raster.tile_gen[(entry->addr-0x8000)>>4]++;
+				}
+				break;
+			case LOG_SYNC:
+				advance_to(entry->dot);
+				break;
+			case LOG_FRAME:
+				advance_to(SCREEN_LINES*DOTS_LINE);
+				render_draw_framebuffer(entry->dot);
+				raster.line = 0;
+				raster.x = 0;
+				break;
+			case LOG_RESET:
+				raster.line = 0;
+				raster.x = 0;
+				break;
+		}
+		tail++;
+		atomic_store_explicit(&raster.tail, tail, memory_order_release);
+		if (tail == head) {
+			head = atomic_load_explicit(&raster.head, memory_order_acquire);
+		}
+	}
+
+	if (raster.threaded) {
+		atomic_thread_fence(memory_order_seq_cst);
+		if (atomic_load_explicit(&raster.is_ppu_waiting, memory_order_relaxed) &&
+				atomic_exchange_explicit(&raster.is_ppu_waiting, false, memory_order_relaxed)) {
+			sem_post(&raster.space);
+		}
+	}
+}
+
+static void *raster_thread(void *v) {
+	while (1) {
+		sem_wait(&raster.wakeup);
+		if (atomic_load(&raster.quit)) {
+			break;
+		}
+		raster_run();
+	}
+	return NULL;
+}
+
+int raster_start_thread() {
+	if (sem_init(&raster.wakeup, 0, 0) == -1) {
+		perror("sem_init()");
+		return -1;
+	}
+	if (sem_init(&raster.space, 0, 0) == -1) {
+		perror("sem_init()");
+		sem_destroy(&raster.wakeup);
+		return -1;
+	}
+	// set before the thread is, so that raster_run() on it sees it.
+	raster.threaded = true;
+	atomic_store(&raster.quit, false);
+	if (pthread_create(&raster.thread, NULL, raster_thread, NULL)) {
+		fprintf(stderr, "error: pthread_create()");
+		raster.threaded = false;
+		sem_destroy(&raster.space);
+		sem_destroy(&raster.wakeup);
+		return -1;
+	}
+	return 0;
+}
+
+void raster_stop_thread() {
+	if (!raster.threaded) {
+		return;
+	}
+	// let it finish whatever it's drawing.
+	atomic_store(&raster.quit, true);
+	sem_post(&raster.wakeup);
+	pthread_join(raster.thread, NULL);
+	sem_destroy(&raster.space);
+	sem_destroy(&raster.wakeup);
+	raster.threaded = false;
+}
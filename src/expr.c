@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "expr.h"
+
+#include "cpu.h"
+#include "monitor.h"
+
+#define EXPR_STACK_SIZE 16
+
+static bool is_reg(uint8_t reg) {
+	return reg <= CPU_REG_PC || (reg >= EXPR_REG_A && reg <= EXPR_REG_L);
+}
+
+int expr_check(const uint8_t *code, size_t len) {
+	int depth = 0;
+	size_t i = 0;
+	while (i < len) {
+		uint8_t op = code[i++];
+		switch (op) {
+			case EXPR_END:
+				if (depth != 1 || i != len)
+					goto err;
+				return 0;
+			case EXPR_IMM:
+				if (i + 2 > len)
+					goto err;
+				i += 2;
+				depth++;
+				break;
+			case EXPR_REG:
+				if (i + 1 > len || !is_reg(code[i]))
+					goto err;
+				i++;
+				depth++;
+				break;
+			case EXPR_ACCESS_ADDR:
+			case EXPR_ACCESS_VALUE:
+				depth++;
+				break;
+			case EXPR_MEM:
+			case EXPR_NOT:
+				if (depth < 1)
+					goto err;
+				break;
+			default:
+				if (op >= EXPR_NUM_OPS || depth < 2)
+					goto err;
+				depth--;
+		}
+		if (depth > EXPR_STACK_SIZE)
+			goto err;
+	}
+
+err:
+	fprintf(stderr, "error: expr_check(): malformed expression\n");
+	return -1;
+}
+
+static int32_t get_reg(uint8_t reg) {
+	uint32_t value = 0;
+	struct peek peek = {
+		.type = PEEK_CPU,
+		.subtype = CPU_PEEK_REG,
+		.req = reg >= EXPR_REG_A ? CPU_REG_AF + (reg - EXPR_REG_A)/2 : reg
+	};
+	struct peek_reply peek_reply = { .capacity = sizeof(value), .payload = &value };
+	cpu_peek(&peek, &peek_reply);
+
+	if (reg < EXPR_REG_A)
+		return value & 0xffff;
+	// the high byte first (eg, a in af).
+	return (reg - EXPR_REG_A) % 2 ? value & 0xff : (value >> 8) & 0xff;
+}
+
+bool expr_eval(const uint8_t *code, const struct expr_access *access) {
+	int32_t stack[EXPR_STACK_SIZE];
+	int top = -1;
+
+	while (true) {
+		uint8_t op = *code++;
+		int32_t b;
+		switch (op) {
+			case EXPR_END:
+				return stack[top] != 0;
+			case EXPR_IMM:
+				uint16_t imm;
+				memcpy(&imm, code, sizeof(imm));
+				code += sizeof(imm);
+				stack[++top] = imm;
+				continue;
+			case EXPR_REG:
+				stack[++top] = get_reg(*code++);
+				continue;
+			case EXPR_MEM:
+				stack[top] = monitor_peek_mem(stack[top]);
+				continue;
+			case EXPR_ACCESS_ADDR:
+				stack[++top] = access ? access->addr : 0;
+				continue;
+			case EXPR_ACCESS_VALUE:
+				stack[++top] = access ? access->value : 0;
+				continue;
+			case EXPR_NOT:
+				stack[top] = !stack[top];
+				continue;
+		}
+
+		// binary ops
+		b = stack[top--];
+		int32_t *a = &stack[top];
+		switch (op) {
+			case EXPR_EQ: *a = *a == b; break;
+			case EXPR_NE: *a = *a != b; break;
+			case EXPR_LT: *a = *a < b; break;
+			case EXPR_LE: *a = *a <= b; break;
+			case EXPR_GT: *a = *a > b; break;
+			case EXPR_GE: *a = *a >= b; break;
+			case EXPR_AND: *a = *a && b; break;
+			case EXPR_OR: *a = *a || b; break;
+			case EXPR_BAND: *a &= b; break;
+			case EXPR_BOR: *a |= b; break;
+			case EXPR_ADD: *a += b; break;
+			case EXPR_SUB: *a -= b; break;
+		}
+	}
+}
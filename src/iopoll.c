@@ -75,7 +75,7 @@ static void *iopoll_thread(void *v) {
 			}
 			for (int i = 0; i < num_events; i++) {
 				if (server_fd == event_list[i].data.fd) {
-					server_recv_request_and_dispatch();
+					server_recv_request();
 				}
 				else {
 					backends_dispatch(event_list[i].data.fd);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+
+// inputs whose frame hasn't made it to the screen yet.
+#define MAX_PENDING 32
+
+struct pending {
+	int64_t input_time;
+	uint32_t frame;
+	bool is_committed;
+};
+
+struct window {
+	int64_t samples[LATENCY_WINDOW];
+	unsigned next;
+	unsigned count;
+};
+
+// samples come from the emulation, frames from the display backend; none of
+// it is in a hot path (it's paced by a human pressing buttons), so a mutex
+// will do.
+typedef struct {
+	pthread_mutex_t mtx;
+	struct pending pending[MAX_PENDING];
+	int num_pending;
+	struct window commit;
+	struct window present;
+} latency_t;
+static latency_t latency = { .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+// whether frame 'a' is 'b' or a later one.
+static bool is_frame_at_least(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) >= 0;
+}
+
+static void add_sample(struct window *w, int64_t sample) {
+	w->samples[w->next] = sample;
+	w->next = (w->next + 1) % LATENCY_WINDOW;
+	if (w->count < LATENCY_WINDOW)
+		w->count++;
+}
+
+static void remove_pending(int i) {
+	latency.pending[i] = latency.pending[--latency.num_pending];
+}
+
+void latency_input_read(int64_t input_time, uint32_t frame) {
+	pthread_mutex_lock(&latency.mtx);
+	if (latency.num_pending < MAX_PENDING) {
+		latency.pending[latency.num_pending++] = (struct pending) {
+			.input_time = input_time,
+			.frame = frame
+		};
+	}
+	pthread_mutex_unlock(&latency.mtx);
+}
+
+void latency_frame_committed(uint32_t frame, int64_t time, bool will_be_presented) {
+	pthread_mutex_lock(&latency.mtx);
+	for (int i = 0; i < latency.num_pending; i++) {
+		struct pending *p = &latency.pending[i];
+		if (p->is_committed || !is_frame_at_least(frame, p->frame)) {
+			continue;
+		}
+		add_sample(&latency.commit, time - p->input_time);
+		p->is_committed = true;
+		if (!will_be_presented) {
+			remove_pending(i--);
+		}
+	}
+	pthread_mutex_unlock(&latency.mtx);
+}
+
+void latency_frame_presented(uint32_t frame, int64_t time) {
+	pthread_mutex_lock(&latency.mtx);
+	for (int i = 0; i < latency.num_pending; i++) {
+		struct pending *p = &latency.pending[i];
+		if (!p->is_committed || !is_frame_at_least(frame, p->frame)) {
+			continue;
+		}
+		add_sample(&latency.present, time - p->input_time);
+		remove_pending(i--);
+	}
+	pthread_mutex_unlock(&latency.mtx);
+}
+
+static int cmp_samples(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void get_percentiles(const struct window *w, int64_t *p50, int64_t *p99) {
+	int64_t sorted[LATENCY_WINDOW];
+	if (!w->count) {
+		*p50 = *p99 = 0;
+		return;
+	}
+	memcpy(sorted, w->samples, w->count * sizeof(sorted[0]));
+	qsort(sorted, w->count, sizeof(sorted[0]), cmp_samples);
+	*p50 = sorted[(w->count-1) * 50 / 100];
+	*p99 = sorted[(w->count-1) * 99 / 100];
+}
+
+struct latency_stats latency_get_stats() {
+	struct latency_stats stats;
+
+	pthread_mutex_lock(&latency.mtx);
+	stats.num_samples = latency.commit.count;
+	get_percentiles(&latency.commit, &stats.commit_p50, &stats.commit_p99);
+	stats.num_presented_samples = latency.present.count;
+	get_percentiles(&latency.present, &stats.present_p50, &stats.present_p99);
+	pthread_mutex_unlock(&latency.mtx);
+
+	return stats;
+}
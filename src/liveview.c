@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "liveview.h"
+
+#include "monitor.h"
+
+static int liveview_fd = -1;
+// published once the memfd is ready.
+static struct liveview *_Atomic liveview;
+
+int liveview_get_fd() {
+	if (liveview_fd != -1) {
+		return liveview_fd;
+	}
+
+	int fd = memfd_create("realboy-liveview", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		perror("memfd_create()");
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(struct liveview)) == -1) {
+		perror("ftruncate()");
+		goto err;
+	}
+	// clients may map it, but not resize it under us.
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+	struct liveview *view = mmap(NULL, sizeof(struct liveview), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (view == MAP_FAILED) {
+		perror("mmap()");
+		goto err;
+	}
+	view->magic = LIVEVIEW_MAGIC;
+	view->version = LIVEVIEW_VERSION;
+
+	liveview_fd = fd;
+	atomic_store_explicit(&liveview, view, memory_order_release);
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+size_t liveview_get_size() {
+	return sizeof(struct liveview);
+}
+
+static void copy_range(uint8_t *dst, uint16_t addr, size_t len) {
+	for (size_t i = 0; i < len; i += 0x100) {
+		size_t n = len - i < 0x100 ? len - i : 0x100;
+		size_t valid;
+		uint8_t *src = monitor_get_mem_ptr(addr + i, &valid);
+		assert(src && valid >= n);
+		memcpy(dst + i, src, n);
+	}
+}
+
+void liveview_update(uint64_t frame) {
+	struct liveview *view = atomic_load_explicit(&liveview, memory_order_acquire);
+	if (!view) {
+		return;
+	}
+
+	uint32_t seq = atomic_load_explicit(&view->seq, memory_order_relaxed);
+	atomic_store_explicit(&view->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	view->frame = frame;
+	copy_range(view->vram, 0x8000, sizeof(view->vram));
+	copy_range(view->wram, 0xc000, sizeof(view->wram));
+	copy_range(view->oam, 0xfe00, sizeof(view->oam));
+	copy_range(view->hram, 0xff80, sizeof(view->hram));
+	for (uint16_t i = 0; i < sizeof(view->io); i++) {
+		view->io[i] = monitor_peek_mem(0xff00 + i);
+	}
+	view->ie = monitor_peek_mem(0xffff);
+
+	atomic_store_explicit(&view->seq, seq + 2, memory_order_release);
+}
+
+void liveview_fini() {
+	struct liveview *view = atomic_exchange(&liveview, nullptr);
+	if (view) {
+		munmap(view, sizeof(*view));
+	}
+	if (liveview_fd != -1) {
+		close(liveview_fd);
+	}
+	liveview_fd = -1;
+}
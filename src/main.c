@@ -17,24 +17,50 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
 #include <getopt.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "backends/backends.h"
 #include "monitor.h"
 #include "iopoll.h"
+#include "movie.h"
+#include "ppu.h"
 #include "render.h"
+#include "scaler.h"
 #include "server.h"
 
 FILE *rom;
 
 static sigjmp_buf fini;
+// a recording is ended at the next input sync point instead, so that the
+// movie ends on a state that can be reproduced.
+static volatile sig_atomic_t is_recording;
 static void sigterm_handler(int sig) {
+	if (is_recording) {
+		is_recording = false;
+		movie_stop();
+		return;
+	}
 	longjmp(fini, 1);
 }
 
+// 'arg' as a whole number in [min, max]; -1 if it isn't one.
+static int parse_int(const char *arg, long min, long max) {
+	char *end;
+	errno = 0;
+	long value = strtol(arg, &end, 10);
+	if (errno || end == arg || *end || value < min || value > max) {
+		return -1;
+	}
+	return value;
+}
+
 int main(int argc, char *argv[]) {
 	int ret = 0;
 
@@ -43,13 +69,61 @@ int main(int argc, char *argv[]) {
 	}
 
 	bool wait_for_client = false;
+	int scale = 0;
+	const char *record_path = nullptr;
+	const char *play_path = nullptr;
+	const char *keyframes_path = nullptr;
+	const char *verify_path = nullptr;
+	int jobs = 0;
 	int option;
 	do {
-		option = getopt(argc, argv, "s");
+		option = getopt(argc, argv, "sr:x:lm:p:k:v:j:");
 		switch (option) {
 			case 's':
 				wait_for_client = true;
 				break;
+			case 'r':
+				if (!strcmp(optarg, "line")) {
+					ppu_set_raster_mode(PPU_RASTER_LINE);
+				}
+				else if (!strcmp(optarg, "frame")) {
+					ppu_set_raster_mode(PPU_RASTER_FRAME);
+				}
+				else if (!strcmp(optarg, "thread")) {
+					ppu_set_raster_mode(PPU_RASTER_THREAD);
+				}
+				else {
+					fprintf(stderr, "unknown raster mode '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'x':
+				if ((scale = parse_int(optarg, 1, SCALER_MAX_FACTOR)) == -1) {
+					fprintf(stderr, "scale factor must be between 1 and %d\n", SCALER_MAX_FACTOR);
+					return -1;
+				}
+				break;
+			case 'l':
+				render_set_smooth(true);
+				break;
+			case 'm':
+				record_path = optarg;
+				break;
+			case 'p':
+				play_path = optarg;
+				break;
+			case 'k':
+				keyframes_path = optarg;
+				break;
+			case 'v':
+				verify_path = optarg;
+				break;
+			case 'j':
+				if ((jobs = parse_int(optarg, 1, 1024)) == -1) {
+					fprintf(stderr, "bad number of jobs '%s'\n", optarg);
+					return -1;
+				}
+				break;
 			default:
 				break;
 		}
@@ -63,14 +137,79 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	ret = render_init();
+	if (record_path && play_path) {
+		fprintf(stderr, "can't record and play back a movie at once\n");
+		ret = -1;
+		goto err_movie;
+	}
+	if (record_path) {
+		ret = movie_record(record_path, rom);
+		is_recording = ret == 0;
+	}
+	else if (play_path) {
+		ret = movie_play(play_path, rom);
+	}
 	if (ret == -1) {
+		goto err_movie;
+	}
+	if (verify_path && (!play_path || keyframes_path)) {
+		fprintf(stderr, "verifying needs a movie to play back, and writes no keyframes\n");
+		ret = -1;
+		goto err_backends;
+	}
+	if (keyframes_path && (ret = movie_write_keyframes(keyframes_path)) == -1) {
+		goto err_backends;
+	}
+	if (verify_path) {
+		// the segments run in processes of their own, which don't get
+		// the rasterizer thread.
+		ppu_set_raster_mode(PPU_RASTER_FRAME);
+		if (jobs <= 0)
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	// movies play back headless, as fast as possible.
+	bool headless = movie_is_playing();
+	if (headless) {
+		monitor_set_throttle(false);
+	}
+
+	if (!headless) {
+		ret = backends_init();
+		if (ret == -1) {
+			goto err_backends;
+		}
+	}
+
+	// if the display can scale the frames by itself, keep the framebuffer at
+	// the native resolution, unless asked otherwise.
+	struct backend_display_ext *display = headless ? nullptr :
+		(struct backend_display_ext *)backends_get_backend_by_type(BACKEND_DISPLAY);
+	if (!scale) {
+		scale = display && display->can_scale && display->can_scale() ? 1 : 4;
+	}
+	if ((ret = render_set_scale(scale)) == -1) {
+		fprintf(stderr, "scale factor must be between 1 and 8\n");
 		goto err_render;
 	}
+	// the smallest framebuffer format the display takes.
+	if (display && display->supports_format) {
+		for (enum render_format format = 0; format < RENDER_NUM_FORMATS; format++) {
+			if (display->supports_format(format)) {
+				render_set_format(format);
+				break;
+			}
+		}
+	}
 
-	ret = backends_init();
+	ret = render_init();
 	if (ret == -1) {
-		goto err_backends;
+		goto err_render;
+	}
+
+	if (display && display->set_framebuffer) {
+		struct framebuffer fb = render_get_framebuffer_dimensions();
+		fb.fd = render_get_framebuffer_fd();
+		display->set_framebuffer(&fb);
 	}
 
 	ret = server_init(wait_for_client);
@@ -84,9 +223,11 @@ int main(int argc, char *argv[]) {
 	}
 
 	// initialize the io poll thread
-	ret = iopoll_init();
-	if (ret == -1) {
-		goto err_io;
+	if (!headless) {
+		ret = iopoll_init();
+		if (ret == -1) {
+			goto err_io;
+		}
 	}
 
 	// we handle SIGINT so that the user can ctrl+c to quit.
@@ -99,7 +240,7 @@ int main(int argc, char *argv[]) {
 	struct sigaction sig = { .sa_handler = sigterm_handler };
 	sigaction(SIGINT, &sig, NULL);
 	if ((ret = setjmp(fini)) == 0) {
-		ret = monitor_run();
+		ret = verify_path ? movie_verify(verify_path, jobs) : monitor_run();
 	}
 
 err_io:
@@ -107,10 +248,13 @@ err_io:
 err_monitor:
 	server_fini();
 err_server:
-	backends_fini();
-err_backends:
 	render_fini();
 err_render:
+	if (!headless)
+		backends_fini();
+err_backends:
+	movie_fini();
+err_movie:
 	fclose(rom);
 err_open:
 	return ret;
@@ -20,67 +20,284 @@
 
 #include "backends/backends.h"
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 
 #include <linux/input.h>
 #include <poll.h>
-#include <pthread.h>
 
 #include "monitor.h"
 #include "cpu.h"
+#include "joypad.h"
+#include "latency.h"
+#include "liveview.h"
 #include "mbc.h"
+#include "rewind.h"
 #include "ppu.h"
 #include "server.h"
 
 static mbc_iface_t *mbc_impl;
 
-static bool start_released=true;
-static bool select_released=true;
-static bool a_released=true;
-static bool b_released=true;
-static bool up_released=true;
-static bool down_released=true;
-static bool left_released=true;
-static bool right_released=true;
+static bool should_quit;
+static int quit_ret;
+static bool is_throttled = true;
 
-static void exec_next() {
+// input is picked up once per scanline worth of m-cycles.
+#define JOYPAD_SYNC_CYCLES 114
+static int joypad_sync_cycles = JOYPAD_SYNC_CYCLES;
+// m-cycles since power on.
+static uint64_t cycle_count;
+
+// returns whether it reached a sync point.
+static bool exec_next() {
 	int cycles = cpu_exec_next();
 	ppu_refresh(cycles);
+	cycle_count += cycles;
+
+	joypad_sync_cycles -= cycles;
+	if (joypad_sync_cycles <= 0) {
+		// reload first; a snapshot taken at the sync point (see
+		// movie_sync_end()) resumes right after it.
+		joypad_sync_cycles += JOYPAD_SYNC_CYCLES;
+		joypad_sync();
+		rewind_sync();
+		return true;
+	}
+	return false;
 }
 
-void monitor_throttle_fps() {
-	static uint64_t frame_count_last = 0;
-	static struct timespec last;
-	static int sleep_factor = 60;
+// a dmg frame is 70224 dots, at 4194304 dots per second.
+#define DMG_FRAME_NS 16742706
+#define NS_PER_SEC 1000000000L
+
+// if the display refreshes within this much of the dmg rate, we run at
+// the display's rate instead, in phase with its refresh.
+#define PACE_LOCK_TOLERANCE_NS (DMG_FRAME_NS/50)
+// finish each frame this long before the display refreshes, so that the
+// compositor has time to pick it up.
+#define PACE_LEAD_NS 4000000L
+
+// only touched by the emulation thread.
+struct pacing_stats {
+	// since the last time they were printed (each second).
+	uint64_t frames;
+	int64_t lateness_sum; // how late we woke up after the deadlines, in ns
+	int64_t lateness_max;
+	bool is_locked; // whether we follow the display's refresh
+};
 
+static struct {
+	// absolute time (CLOCK_MONOTONIC) at which the next frame is due.
+	int64_t deadline;
+
+	// last presentation reported by the display backend (iopoll thread).
+	_Atomic int64_t presented;
+	_Atomic uint32_t refresh;
+
+	struct pacing_stats stats;
+	uint64_t frame_count_last;
+	uint64_t skipped_frame_count_last;
+	int64_t stats_last;
+} pacer;
+
+static int64_t timespec_to_ns(const struct timespec *ts) {
+	return ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static int64_t get_time_ns() {
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_ns(&now);
+}
+
+void monitor_report_presentation(int64_t presented, uint32_t refresh) {
+	atomic_store(&pacer.refresh, refresh);
+	atomic_store(&pacer.presented, presented);
+}
+
+static void update_pacing_stats(int64_t now, int64_t lateness) {
+	struct pacing_stats *stats = &pacer.stats;
+
+	stats->frames++;
+	stats->lateness_sum += lateness;
+	if (lateness > stats->lateness_max)
+		stats->lateness_max = lateness;
+
+	if (now - pacer.stats_last >= NS_PER_SEC) {
+		uint64_t frame_count = ppu_get_frame_count();
+		uint64_t skipped_frame_count = ppu_get_skipped_frame_count();
+		uint64_t frames = frame_count - pacer.frame_count_last;
+		printf("FPS %" PRIu64 " (%" PRIu64 "%% unchanged) lateness avg %" PRId64 "us max %" PRId64 "us%s\n",
+			frames, frames ? (skipped_frame_count - pacer.skipped_frame_count_last) * 100 / frames : 0,
+			stats->lateness_sum / (int64_t)stats->frames / 1000, stats->lateness_max / 1000,
+			stats->is_locked ? " (locked to display)" : "");
+		pacer.frame_count_last = frame_count;
+		pacer.skipped_frame_count_last = skipped_frame_count;
+
+		struct latency_stats latency = latency_get_stats();
+		if (latency.num_samples) {
+			printf("input latency to commit p50 %" PRId64 "us p99 %" PRId64 "us", latency.commit_p50 / 1000,
+				latency.commit_p99 / 1000);
+			if (latency.num_presented_samples) {
+				printf(", to screen p50 %" PRId64 "us p99 %" PRId64 "us", latency.present_p50 / 1000,
+					latency.present_p99 / 1000);
+			}
+			printf(" (%u samples)\n", latency.num_samples);
+		}
+		pacer.stats_last = now;
+		stats->frames = 0;
+		stats->lateness_sum = 0;
+		stats->lateness_max = 0;
+	}
+}
+
+void monitor_set_throttle(bool throttle) {
+	is_throttled = throttle;
+}
 
-	if (!frame_count_last) {
-		frame_count_last = ppu_get_frame_count();
-		last = now;
+bool monitor_is_throttled() {
+	return is_throttled;
+}
+
+void monitor_end_frame() {
+	liveview_update(ppu_get_frame_count());
+	monitor_throttle_fps();
+}
+
+void monitor_throttle_fps() {
+	if (!is_throttled) {
+		return;
+	}
+
+	int64_t now = get_time_ns();
+	if (!pacer.deadline) {
+		pacer.deadline = now + DMG_FRAME_NS;
+		pacer.stats_last = now;
+		pacer.frame_count_last = ppu_get_frame_count();
+		pacer.skipped_frame_count_last = ppu_get_skipped_frame_count();
 		return;
 	}
 
-	if (now.tv_sec > last.tv_sec) {
-		uint64_t curr_frame_count = ppu_get_frame_count();
-		uint64_t fps = curr_frame_count - frame_count_last;
-		printf("FPS %lu sleep_factor %d\n", fps, sleep_factor);
-		if (fps > 60)
-			sleep_factor--;
-		else if (fps < 60)
-			sleep_factor++;
-		frame_count_last = curr_frame_count;
-		last = now;
+	int64_t period = DMG_FRAME_NS;
+	int64_t refresh = atomic_load(&pacer.refresh);
+	pacer.stats.is_locked = refresh && llabs(refresh - DMG_FRAME_NS) < PACE_LOCK_TOLERANCE_NS;
+	if (pacer.stats.is_locked) {
+		period = refresh;
+
+		// nudge the deadline towards PACE_LEAD_NS before the next refresh.
+		int64_t presented = atomic_exchange(&pacer.presented, 0);
+		if (presented) {
+			int64_t target = presented - PACE_LEAD_NS;
+			int64_t err = (pacer.deadline - target) % period;
+			if (err > period/2)
+				err -= period;
+			else if (err < -period/2)
+				err += period;
+			pacer.deadline -= err/8;
+		}
+	}
+
+	if (now < pacer.deadline) {
+		struct timespec deadline = {
+			.tv_sec = pacer.deadline / NS_PER_SEC,
+			.tv_nsec = pacer.deadline % NS_PER_SEC
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+		now = get_time_ns();
+	}
+	update_pacing_stats(now, now - pacer.deadline);
+
+	pacer.deadline += period;
+	// if we fell behind by more than a frame (eg, the process was stopped),
+	// don't try to catch up.
+	if (now > pacer.deadline) {
+		pacer.deadline = now + period;
 	}
-	struct timespec spec = { .tv_sec = 0, .tv_nsec = 1000000000/sleep_factor };
-	nanosleep(&spec, NULL);
 }
 
 uint8_t tmp_ioregs[0xffff];
-uint8_t monitor_rd_mem(uint16_t addr) {
+
+int peek_reply_put(struct peek_reply *reply, const void *data, size_t len) {
+	if (reply->size + len > reply->capacity) {
+		fprintf(stderr, "error: peek_reply_put(): reply too big\n");
+		return -1;
+	}
+	memcpy((uint8_t *)reply->payload + reply->size, data, len);
+	reply->size += len;
+	return 0;
+}
+
+uint64_t monitor_get_cycle_count() {
+	return cycle_count;
+}
+
+uint16_t monitor_get_rom_bank() {
+	return mbc_impl->get_rom_bank();
+}
+
+// below this, every address is handled by some module, and tmp_ioregs goes
+// unused.
+#define TMP_IOREGS_START 0xe000
+#define TMP_IOREGS_SIZE (sizeof(tmp_ioregs) - TMP_IOREGS_START)
+
+size_t monitor_save(uint8_t *buf) {
+	size_t size = 0;
+
+	size += cpu_save(buf ? buf + size : nullptr);
+	size += ppu_save(buf ? buf + size : nullptr);
+	size += joypad_save(buf ? buf + size : nullptr);
+	size += mbc_impl->save(buf ? buf + size : nullptr);
+	if (buf) {
+		memcpy(buf + size, &tmp_ioregs[TMP_IOREGS_START], TMP_IOREGS_SIZE);
+		size += TMP_IOREGS_SIZE;
+		memcpy(buf + size, &joypad_sync_cycles, sizeof(joypad_sync_cycles));
+		size += sizeof(joypad_sync_cycles);
+		memcpy(buf + size, &cycle_count, sizeof(cycle_count));
+		size += sizeof(cycle_count);
+	}
+	else {
+		size += TMP_IOREGS_SIZE + sizeof(joypad_sync_cycles) + sizeof(cycle_count);
+	}
+
+	return size;
+}
+
+void monitor_load(const uint8_t *buf) {
+	buf += cpu_load(buf);
+	buf += ppu_load(buf);
+	buf += joypad_load(buf);
+	buf += mbc_impl->load(buf);
+	memcpy(&tmp_ioregs[TMP_IOREGS_START], buf, TMP_IOREGS_SIZE);
+	buf += TMP_IOREGS_SIZE;
+	memcpy(&joypad_sync_cycles, buf, sizeof(joypad_sync_cycles));
+	buf += sizeof(joypad_sync_cycles);
+	memcpy(&cycle_count, buf, sizeof(cycle_count));
+}
+
+void monitor_step() {
+	exec_next();
+}
+
+// pages (addr >> 8) with watches, and what kind (enum monitor_watch).
+static uint8_t watch_pages[0x100];
+static monitor_watch_fn watch_handler;
+
+void monitor_set_watch_handler(monitor_watch_fn handler) {
+	watch_handler = handler;
+}
+
+void monitor_set_watch_page(uint8_t page, uint8_t kinds) {
+	watch_pages[page] = kinds;
+}
+
+// 'is_peek' reads without the side effects that a read by the game has.
+static uint8_t rd_mem(uint16_t addr, bool is_peek) {
 	if ((addr >= 0x8000 && addr <= 0x9fff) ||
 			(addr >= 0xfe00 && addr <= 0xfe9f) ||
 			(addr >= 0xff40 && addr <= 0xff4b)) {
@@ -105,31 +322,34 @@ uint8_t monitor_rd_mem(uint16_t addr) {
 		case 0xff07:
 		case 0xff50:
 			return cpu_rd(addr);
+		case 0xff00:
+			return is_peek ? joypad_peek() : joypad_rd();
 		default:
-			if (addr == 0xff00) {
-				if ((tmp_ioregs[addr] & 0x30) == 0x30) {
-					return 0x3f;
-				}
-				else {
-					uint8_t ret;
-					if (tmp_ioregs[addr] & 0x10) {
-						ret = tmp_ioregs[addr] |
-							(start_released<<3|select_released<<2|b_released<<1|a_released);
-					}
-					else {
-						ret = tmp_ioregs[addr] |
-							(down_released<<3|up_released<<2|left_released<<1|right_released);
-					}
-					return ret;
-				}
-			}
-			else {
-				return tmp_ioregs[addr];
-			}
+			return tmp_ioregs[addr];
 	}
 }
 
+uint8_t monitor_rd_mem(uint16_t addr) {
+	uint8_t value = rd_mem(addr, false);
+	if (watch_pages[addr >> 8] & MONITOR_WATCH_READ) {
+		watch_handler(MONITOR_WATCH_READ, addr, value, value);
+	}
+	return value;
+}
+
+uint8_t monitor_fetch_mem(uint16_t addr) {
+	return rd_mem(addr, false);
+}
+
+uint8_t monitor_peek_mem(uint16_t addr) {
+	return rd_mem(addr, true);
+}
+
 void monitor_wr_mem(uint16_t addr, uint8_t value) {
+	if (watch_pages[addr >> 8] & MONITOR_WATCH_WRITE) {
+		watch_handler(MONITOR_WATCH_WRITE, addr, rd_mem(addr, true), value);
+	}
+
 	if (addr == 0xffff) {
 		cpu_wr(addr, value);
 	}
@@ -168,80 +388,121 @@ void monitor_wr_mem(uint16_t addr, uint8_t value) {
 	}
 	else {
 		if (addr == 0xff00) {
-			tmp_ioregs[addr] = value&0x30;
+			joypad_wr(value);
 		}
 		else
 			tmp_ioregs[addr] = value;
 	}
 }
 
+uint8_t *monitor_get_mem_ptr(uint16_t addr, size_t *len) {
+	*len = 0x100 - (addr & 0xff);
+	if (addr >= 0x8000 && addr <= 0x9fff) {
+		return ppu_get_mem_ptr(addr);
+	}
+	if (addr >= 0xfe00 && addr <= 0xfe9f) {
+		*len = 0xfea0 - addr;
+		return ppu_get_mem_ptr(addr);
+	}
+	if (addr >= 0xc000 && addr <= 0xdfff) {
+		return cpu_get_mem_ptr(addr);
+	}
+	if (addr >= 0xff80 && addr <= 0xfffe) {
+		*len = 0xffff - addr;
+		return cpu_get_mem_ptr(addr);
+	}
+	if (addr <= 0xbfff) {
+		return mbc_impl->get_mem_ptr(addr);
+	}
+	*len = 0;
+	return nullptr;
+}
+
 void monitor_set_key(struct input_event *ev) {
 	struct backend_display_ext *backend = (struct backend_display_ext *)backends_get_backend_by_type(BACKEND_DISPLAY);
 
 	if (backend->is_focus()) {
+		enum joypad_button button;
 		switch (ev->code) {
 			case KEY_ENTER:
-				start_released = !ev->value;
+				button = JOYPAD_START;
 				break;
 			case KEY_DOWN:
 			case KEY_J:
-				down_released = !ev->value;
+				button = JOYPAD_DOWN;
 				break;
 			case KEY_SPACE:
-				select_released = !ev->value;
+				button = JOYPAD_SELECT;
 				break;
 			case KEY_UP:
 			case KEY_K:
-				up_released = !ev->value;
+				button = JOYPAD_UP;
 				break;
 			case KEY_S:
-				b_released = !ev->value;
+				button = JOYPAD_B;
 				break;
 			case KEY_LEFT:
 			case KEY_H:
-				left_released = !ev->value;
+				button = JOYPAD_LEFT;
 				break;
 			case KEY_D:
-				a_released = !ev->value;
+				button = JOYPAD_A;
 				break;
 			case KEY_RIGHT:
 			case KEY_L:
-				right_released = !ev->value;
+				button = JOYPAD_RIGHT;
 				break;
 			default:
 				fprintf(stderr, "monitor_set_key()");
+				return;
 		}
+		// ev->value is 2 for autorepeat; the button is still down.
+		joypad_push_event(button, ev->value,
+			ev->input_event_sec * NS_PER_SEC + ev->input_event_usec * 1000L);
 	}
 }
 
+void monitor_quit(int ret) {
+	should_quit = true;
+	quit_ret = ret;
+}
+
 int monitor_run() {
-	while (1) {
+	while (!should_quit) {
 		if (server_is_client_connected()) {
-			pthread_mutex_lock(&mtx_server);
 			if (server_is_stopped()) {
-				pthread_cond_wait(&cnd_server_stop, &mtx_server);
-				pthread_mutex_unlock(&mtx_server);
+				server_wait_requests();
 				continue;
 			}
-			pthread_mutex_unlock(&mtx_server);
 			do {
-				exec_next();
-			} while (!server_should_stop_execution());
-			pthread_mutex_lock(&mtx_server);
-			pthread_mutex_unlock(&mtx_server);
-			pthread_cond_signal(&cnd_server_stop);
+				// the client's requests are picked up at sync points, so that
+				// running costs no more than checking for breakpoints.
+				if (exec_next()) {
+					server_dispatch_requests();
+				}
+			} while (!server_should_stop_execution() && !should_quit);
 		}
 		else {
 			exec_next();
 		}
 	}
-	return -1;
+	return quit_ret;
 }
 
 void monitor_fini() {
+	ppu_fini();
+	liveview_fini();
+	rewind_fini();
 }
 
 int monitor_init() {
 	mbc_impl = mbc_init();
+	if (ppu_init() == -1) {
+		return -1;
+	}
+	// the debugger can go back in time.
+	if (server_is_client_connected()) {
+		return rewind_start();
+	}
 	return 0;
 }
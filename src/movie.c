@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "movie.h"
+
+#include "joypad.h"
+#include "monitor.h"
+#include "ppu.h"
+
+#define MOVIE_MAGIC "RBMV"
+#define MOVIE_VERSION 2
+#define MOVIE_INITIAL_STATE_POWER_ON 0
+#define MOVIE_HEADER_SIZE (4 + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+
+#define KEYFRAMES_MAGIC "RBKF"
+#define KEYFRAMES_VERSION 3
+#define KEYFRAMES_HEADER_SIZE (4 + sizeof(uint32_t))
+// about every 10s of emulated time; there are 154 sync points per frame.
+#define KEYFRAME_INTERVAL (154*600)
+
+enum movie_record_type {
+	MOVIE_RECORD_INPUT,
+	MOVIE_RECORD_END
+};
+
+enum movie_mode {
+	MOVIE_NONE,
+	MOVIE_RECORDING,
+	MOVIE_PLAYING
+};
+
+struct keyframe {
+	uint64_t sync;
+	uint64_t state_hash;
+	// where the snapshot is in the file.
+	long offset;
+	uint64_t size;
+};
+
+typedef struct {
+	enum movie_mode mode;
+	FILE *file;
+	const char *path;
+
+	// written to while recording or playing back, if set.
+	FILE *keyframes;
+	uint8_t *snapshot;
+
+	// when verifying a segment, where it ends and with what state.
+	bool is_segment;
+	uint64_t segment_end;
+	uint64_t segment_hash;
+
+	// sync points so far.
+	uint64_t sync;
+	uint8_t pressed;
+
+	// next record, when playing back.
+	uint8_t next_type;
+	uint64_t next_sync;
+	uint64_t next_value;
+
+	atomic_bool stop_requested;
+	bool is_ok;
+	struct timespec start;
+} movie_t;
+static movie_t movie = { .is_ok = true };
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t hash(uint64_t h, const uint8_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		h ^= data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static uint64_t hash_rom(FILE *rom) {
+	uint64_t h = FNV_OFFSET;
+	uint8_t buf[0x4000];
+	size_t len;
+
+	long pos = ftell(rom);
+	fseek(rom, 0, SEEK_SET);
+	while ((len = fread(buf, 1, sizeof(buf), rom)) > 0) {
+		h = hash(h, buf, len);
+	}
+	fseek(rom, pos, SEEK_SET);
+	return h;
+}
+
+// a snapshot of the whole machine (see monitor_save()), in movie.snapshot;
+// its size, or 0 if there's no memory for it.
+static uint64_t save_state() {
+	uint64_t size = monitor_save(nullptr);
+	if (!movie.snapshot) {
+		movie.snapshot = malloc(size);
+		if (!movie.snapshot) {
+			perror("malloc()");
+			return 0;
+		}
+	}
+	monitor_save(movie.snapshot);
+	return size;
+}
+
+// everything the machine state is made of, so that a replay that diverges
+// anywhere (registers, timers, banks, memory) doesn't match.
+static uint64_t hash_state() {
+	uint64_t size = save_state();
+	return hash(FNV_OFFSET, movie.snapshot, size);
+}
+
+static int write_header(FILE *rom) {
+	uint32_t version = MOVIE_VERSION;
+	uint64_t rom_hash = hash_rom(rom);
+	uint32_t initial_state = MOVIE_INITIAL_STATE_POWER_ON;
+	if (fwrite(MOVIE_MAGIC, 4, 1, movie.file) != 1 ||
+			fwrite(&version, sizeof(version), 1, movie.file) != 1 ||
+			fwrite(&rom_hash, sizeof(rom_hash), 1, movie.file) != 1 ||
+			fwrite(&initial_state, sizeof(initial_state), 1, movie.file) != 1) {
+		perror("fwrite()");
+		return -1;
+	}
+	return 0;
+}
+
+static int read_header(FILE *rom) {
+	char magic[4];
+	uint32_t version;
+	uint64_t rom_hash;
+	uint32_t initial_state;
+	if (fread(magic, 4, 1, movie.file) != 1 ||
+			fread(&version, sizeof(version), 1, movie.file) != 1 ||
+			fread(&rom_hash, sizeof(rom_hash), 1, movie.file) != 1 ||
+			fread(&initial_state, sizeof(initial_state), 1, movie.file) != 1) {
+		fprintf(stderr, "error: movie: truncated header\n");
+		return -1;
+	}
+	if (memcmp(magic, MOVIE_MAGIC, 4) || version != MOVIE_VERSION) {
+		fprintf(stderr, "error: movie: not a movie, or an unsupported version\n");
+		return -1;
+	}
+	if (rom_hash != hash_rom(rom)) {
+		fprintf(stderr, "error: movie: recorded with another rom\n");
+		return -1;
+	}
+	if (initial_state != MOVIE_INITIAL_STATE_POWER_ON) {
+		fprintf(stderr, "error: movie: unsupported initial state\n");
+		return -1;
+	}
+	return 0;
+}
+
+// values are either a byte or a u64; the byte is narrowed first, so that it's
+// the value that gets written whatever the host's endianness.
+static void write_record(uint8_t type, uint64_t value, size_t value_size) {
+	uint8_t byte = value;
+	const void *p = value_size == sizeof(byte) ? (const void *)&byte : &value;
+	if (fwrite(&type, sizeof(type), 1, movie.file) != 1 ||
+			fwrite(&movie.sync, sizeof(movie.sync), 1, movie.file) != 1 ||
+			fwrite(p, value_size, 1, movie.file) != 1) {
+		perror("fwrite()");
+	}
+}
+
+static int read_record() {
+	if (fread(&movie.next_type, sizeof(movie.next_type), 1, movie.file) != 1 ||
+			fread(&movie.next_sync, sizeof(movie.next_sync), 1, movie.file) != 1) {
+		return -1;
+	}
+	if (movie.next_type == MOVIE_RECORD_INPUT) {
+		uint8_t byte;
+		if (fread(&byte, sizeof(byte), 1, movie.file) != 1) {
+			return -1;
+		}
+		movie.next_value = byte;
+		return 0;
+	}
+	if (fread(&movie.next_value, sizeof(movie.next_value), 1, movie.file) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+static int open_movie(const char *path, const char *mode) {
+	movie.file = fopen(path, mode);
+	if (!movie.file) {
+		perror("fopen()");
+		return -1;
+	}
+	movie.path = path;
+	return 0;
+}
+
+// keyframes file format (native endianness):
+//  header: "RBKF", u32 version
+//  keyframes: u64 sync point, u64 state hash, u64 snapshot size, snapshot
+int movie_write_keyframes(const char *path) {
+	movie.keyframes = fopen(path, "wb");
+	if (!movie.keyframes) {
+		perror("fopen()");
+		return -1;
+	}
+	uint32_t version = KEYFRAMES_VERSION;
+	if (fwrite(KEYFRAMES_MAGIC, 4, 1, movie.keyframes) != 1 ||
+			fwrite(&version, sizeof(version), 1, movie.keyframes) != 1) {
+		perror("fwrite()");
+		fclose(movie.keyframes);
+		movie.keyframes = nullptr;
+		return -1;
+	}
+	return 0;
+}
+
+static void write_keyframe() {
+	uint64_t size = save_state();
+	if (!size) {
+		fclose(movie.keyframes);
+		movie.keyframes = nullptr;
+		return;
+	}
+
+	uint64_t state_hash = hash(FNV_OFFSET, movie.snapshot, size);
+	if (fwrite(&movie.sync, sizeof(movie.sync), 1, movie.keyframes) != 1 ||
+			fwrite(&state_hash, sizeof(state_hash), 1, movie.keyframes) != 1 ||
+			fwrite(&size, sizeof(size), 1, movie.keyframes) != 1 ||
+			fwrite(movie.snapshot, size, 1, movie.keyframes) != 1) {
+		perror("fwrite()");
+	}
+}
+
+// read the index of a keyframes file; the snapshots stay on disk.
+static struct keyframe *read_keyframes(FILE *file, size_t *num_keyframes) {
+	char magic[4];
+	uint32_t version;
+	if (fread(magic, 4, 1, file) != 1 ||
+			fread(&version, sizeof(version), 1, file) != 1 ||
+			memcmp(magic, KEYFRAMES_MAGIC, 4) || version != KEYFRAMES_VERSION) {
+		fprintf(stderr, "error: keyframes: not a keyframes file, or an unsupported version\n");
+		return nullptr;
+	}
+
+	struct keyframe *keyframes = nullptr;
+	size_t num = 0, capacity = 0;
+	struct keyframe kf;
+	while (fread(&kf.sync, sizeof(kf.sync), 1, file) == 1 &&
+			fread(&kf.state_hash, sizeof(kf.state_hash), 1, file) == 1 &&
+			fread(&kf.size, sizeof(kf.size), 1, file) == 1) {
+		if (kf.size != monitor_save(nullptr)) {
+			fprintf(stderr, "error: keyframes: snapshot of the wrong size\n");
+			goto err;
+		}
+		kf.offset = ftell(file);
+		if (fseek(file, kf.size, SEEK_CUR) == -1) {
+			perror("fseek()");
+			goto err;
+		}
+		if (num == capacity) {
+			capacity = capacity ? capacity*2 : 64;
+			struct keyframe *tmp = realloc(keyframes, capacity*sizeof(*keyframes));
+			if (!tmp) {
+				perror("realloc()");
+				goto err;
+			}
+			keyframes = tmp;
+		}
+		keyframes[num++] = kf;
+	}
+	if (!num) {
+		fprintf(stderr, "error: keyframes: no keyframes\n");
+		goto err;
+	}
+
+	*num_keyframes = num;
+	return keyframes;
+
+err:
+	free(keyframes);
+	return nullptr;
+}
+
+int movie_record(const char *path, FILE *rom) {
+	if (open_movie(path, "wb") == -1) {
+		return -1;
+	}
+	if (write_header(rom) == -1) {
+		movie_fini();
+		return -1;
+	}
+	movie.mode = MOVIE_RECORDING;
+	return 0;
+}
+
+int movie_play(const char *path, FILE *rom) {
+	if (open_movie(path, "rb") == -1) {
+		return -1;
+	}
+	if (read_header(rom) == -1 || read_record() == -1) {
+		movie_fini();
+		return -1;
+	}
+	movie.mode = MOVIE_PLAYING;
+	clock_gettime(CLOCK_MONOTONIC, &movie.start);
+	return 0;
+}
+
+bool movie_is_playing() {
+	return movie.mode == MOVIE_PLAYING;
+}
+
+void movie_stop() {
+	atomic_store(&movie.stop_requested, true);
+}
+
+bool movie_is_ok() {
+	return movie.is_ok;
+}
+
+static double secs_since(struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void end_playback(uint64_t expected_hash) {
+	movie.is_ok = hash_state() == expected_hash;
+
+	double secs = secs_since(&movie.start);
+	uint64_t frames = ppu_get_frame_count();
+	if (movie.is_segment) {
+		printf("movie: segment ending at sync point %" PRIu64 " (frame %" PRIu64 "): %s, in %.3fs\n",
+			movie.sync, frames, movie.is_ok ? "state matches" : "state MISMATCH", secs);
+	}
+	else {
+		printf("movie: %s, %" PRIu64 " frames in %.3fs (%.1f fps)\n",
+			movie.is_ok ? "state matches" : "state MISMATCH", frames, secs, frames / secs);
+	}
+
+	movie.mode = MOVIE_NONE;
+	monitor_quit(movie.is_ok ? 0 : -1);
+}
+
+uint8_t movie_sync(uint8_t pressed) {
+	if (movie.keyframes && movie.sync && movie.sync % KEYFRAME_INTERVAL == 0) {
+		write_keyframe();
+	}
+	if (movie.is_segment && movie.mode == MOVIE_PLAYING && movie.sync == movie.segment_end) {
+		end_playback(movie.segment_hash);
+	}
+
+	switch (movie.mode) {
+		case MOVIE_RECORDING:
+			if (atomic_load_explicit(&movie.stop_requested, memory_order_relaxed)) {
+				write_record(MOVIE_RECORD_END, hash_state(), sizeof(uint64_t));
+				movie.mode = MOVIE_NONE;
+				monitor_quit(0);
+				break;
+			}
+			if (pressed != movie.pressed) {
+				write_record(MOVIE_RECORD_INPUT, pressed, sizeof(uint8_t));
+				movie.pressed = pressed;
+			}
+			break;
+		case MOVIE_PLAYING:
+			while (movie.mode == MOVIE_PLAYING && movie.next_sync == movie.sync) {
+				if (movie.next_type == MOVIE_RECORD_END) {
+					end_playback(movie.next_value);
+					break;
+				}
+				movie.pressed = movie.next_value;
+				if (read_record() == -1) {
+					fprintf(stderr, "error: movie: truncated\n");
+					movie.is_ok = false;
+					movie.mode = MOVIE_NONE;
+					monitor_quit(-1);
+				}
+			}
+			pressed = movie.pressed;
+			break;
+		default:
+	}
+	movie.sync++;
+	return pressed;
+}
+
+// position the movie being played back at sync point 'sync', as if it had
+// been played back up to there.
+static int seek_movie(uint64_t sync) {
+	if (fseek(movie.file, MOVIE_HEADER_SIZE, SEEK_SET) == -1) {
+		perror("fseek()");
+		return -1;
+	}
+	movie.pressed = 0;
+	while (true) {
+		if (read_record() == -1) {
+			fprintf(stderr, "error: movie: truncated\n");
+			return -1;
+		}
+		if (movie.next_sync >= sync) {
+			break;
+		}
+		if (movie.next_type == MOVIE_RECORD_END) {
+			fprintf(stderr, "error: movie: ends before the keyframes do\n");
+			return -1;
+		}
+		movie.pressed = movie.next_value;
+	}
+	movie.sync = sync;
+	return 0;
+}
+
+// play back the movie from keyframe 'start' (or from power on, if nullptr) up
+// to keyframe 'end' (or to the end of the movie, if nullptr).
+// runs in a process of its own; returns its exit status.
+static int run_segment(const char *keyframes_path, struct keyframe *start, struct keyframe *end) {
+	// the file offsets are shared with the parent and the other segments.
+	fclose(movie.file);
+	if (open_movie(movie.path, "rb") == -1) {
+		return EXIT_FAILURE;
+	}
+
+	if (start) {
+		FILE *file = fopen(keyframes_path, "rb");
+		uint8_t *snapshot = malloc(start->size);
+		if (!file || !snapshot || fseek(file, start->offset, SEEK_SET) == -1 ||
+				fread(snapshot, start->size, 1, file) != 1) {
+			fprintf(stderr, "error: keyframes: can't read the keyframe at sync point %" PRIu64 "\n", start->sync);
+			return EXIT_FAILURE;
+		}
+		fclose(file);
+		monitor_load(snapshot);
+		free(snapshot);
+		if (seek_movie(start->sync) == -1) {
+			return EXIT_FAILURE;
+		}
+	}
+	else if (seek_movie(0) == -1) {
+		return EXIT_FAILURE;
+	}
+
+	if (end) {
+		movie.is_segment = true;
+		movie.segment_end = end->sync;
+		movie.segment_hash = end->state_hash;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &movie.start);
+
+	// the keyframe was taken right as the sync point was reached; pick up
+	// from there.
+	if (start) {
+		joypad_sync();
+	}
+	return monitor_run() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int movie_verify(const char *keyframes_path, int jobs) {
+	FILE *file = fopen(keyframes_path, "rb");
+	if (!file) {
+		perror("fopen()");
+		return -1;
+	}
+	size_t num_keyframes;
+	struct keyframe *keyframes = read_keyframes(file, &num_keyframes);
+	fclose(file);
+	if (!keyframes) {
+		return -1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// segment i goes from keyframe i-1 to keyframe i; the first one starts at
+	// power on, and the last one ends with the movie.
+	size_t num_segments = num_keyframes + 1;
+	size_t next = 0, failed = 0;
+	int running = 0;
+	while (next < num_segments || running) {
+		if (next < num_segments && running < jobs) {
+			struct keyframe *seg_start = next ? &keyframes[next-1] : nullptr;
+			struct keyframe *seg_end = next < num_keyframes ? &keyframes[next] : nullptr;
+			fflush(stdout);
+			pid_t pid = fork();
+			if (pid == -1) {
+				perror("fork()");
+				failed += num_segments - next;
+				next = num_segments;
+				continue;
+			}
+			if (pid == 0) {
+				int status = run_segment(keyframes_path, seg_start, seg_end);
+				fflush(stdout);
+				_exit(status);
+			}
+			next++;
+			running++;
+			continue;
+		}
+
+		int status;
+		if (wait(&status) == -1) {
+			perror("wait()");
+			break;
+		}
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			failed++;
+		}
+	}
+	free(keyframes);
+
+	printf("movie: verified %zu segments with %d jobs in %.3fs: %s\n", num_segments,
+		jobs, secs_since(&start), failed ? "MISMATCH" : "state matches");
+	movie.is_ok = !failed;
+	return failed ? -1 : 0;
+}
+
+void movie_fini() {
+	if (movie.file)
+		fclose(movie.file);
+	movie.file = nullptr;
+	if (movie.keyframes)
+		fclose(movie.keyframes);
+	movie.keyframes = nullptr;
+	free(movie.snapshot);
+	movie.snapshot = nullptr;
+	movie.mode = MOVIE_NONE;
+}
@@ -20,35 +20,145 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <pixman.h>
 
 #include "render.h"
+#include "scaler.h"
+
+// the framebuffer memory holds RENDER_NUM_FRAMES frames, so that neither
+// the drawing side nor the display side ever wait for each other:
+//  - 'back' is the frame being drawn.
+//  - 'ready' is the last complete frame.
+//  - the rest belong to the display backend, which may still be showing
+//    them.
+// when a frame is complete, 'back' and 'ready' are swapped; when the display
+// backend wants a new frame, it swaps 'ready' with a frame it's done with.
+#define FRAME_NEW 0x80000000
 
 typedef struct {
 	void *data;
 	struct framebuffer framebuffer;
-	pixman_image_t *dst;
+	pixman_image_t *dst[RENDER_NUM_FRAMES];
 	pixman_image_t *src;
+	pixman_indexed_t palette;
 	int framebuffer_fd;
+
+	int scale;
+	// scale with pixman's bilinear filter instead of the nearest-neighbor scaler.
+	bool smooth;
+	// the shades, as stored in the framebuffer.
+	uint32_t format_pal[4];
+
+	uint32_t back;
+	_Atomic uint32_t ready;
+	struct render_frame frames[RENDER_NUM_FRAMES];
+	uint64_t seq;
+
+	// the shades of the previous frame, to find out what changed.
+	uint8_t *prev_buf;
+	// written to each time a frame is complete.
+	int frame_ready_fd;
 } render_t;
-render_t render;
+render_t render = {
+	.back = 0,
+	.ready = 1,
+	.scale = 4,
+	.framebuffer.format = RENDER_FORMAT_XRGB8888,
+	.frame_ready_fd = -1
+};
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+// the screen is drawn as one byte per pixel, holding the shade (0-3) of the
+// pixel; the colors are only looked up when the frame is copied to the
+// framebuffer, as part of the scaling.
+static const uint32_t color_pal[] = { 0xe8fccc, 0xacd490, 0x548c70, 0x142c38 };
+
+static const struct {
+	int bpp; // bytes per pixel
+	pixman_format_code_t pixman_format;
+} formats[] = {
+	[RENDER_FORMAT_RGB565] = { 2, PIXMAN_r5g6b5 },
+	[RENDER_FORMAT_XRGB8888] = { 4, PIXMAN_x8r8g8b8 }
+};
+
+static uint32_t to_format(uint32_t color, enum render_format format) {
+	switch (format) {
+		case RENDER_FORMAT_RGB565:
+			return (color >> 8 & 0xf800) | (color >> 5 & 0x07e0) | (color >> 3 & 0x001f);
+		case RENDER_FORMAT_XRGB8888:
+		default:
+			return color;
+	}
+}
 
-pixman_image_t *mask;
 uint8_t *dmg_buf;
-void render_draw_pixel(int x, int y, uint32_t pixel) {
-	assert(x <= 160 && y <= 144);
-	*(uint32_t*)(dmg_buf+(y*160*(32/8))+(x*sizeof(uint32_t))) = pixel;
+void render_draw_pixel(int x, int y, uint8_t shade) {
+	assert(x < SCREEN_WIDTH && y < SCREEN_HEIGHT && shade <= 3);
+	dmg_buf[y*SCREEN_WIDTH + x] = shade;
+}
+
+void render_draw_framebuffer(uint32_t frame_num) {
+	// find the rows that changed since the previous frame.
+	int first = -1;
+	int last = -1;
+	for (int y = 0; y < SCREEN_HEIGHT; y++) {
+		if (memcmp(&dmg_buf[y*SCREEN_WIDTH], &render.prev_buf[y*SCREEN_WIDTH], SCREEN_WIDTH)) {
+			if (first == -1)
+				first = y;
+			last = y;
+		}
+	}
+	// nothing to show.
+	if (first == -1 && render.seq) {
+		return;
+	}
+	if (first == -1) {
+		first = 0;
+		last = SCREEN_HEIGHT-1;
+	}
+	memcpy(render.prev_buf, dmg_buf, SCREEN_WIDTH*SCREEN_HEIGHT);
+
+	if (render.smooth) {
+		// the filter bleeds into the neighboring rows.
+		first = first ? first-1 : 0;
+		last = last < SCREEN_HEIGHT-1 ? last+1 : last;
+		pixman_image_composite32(PIXMAN_OP_SRC, render.src, nullptr,
+			render.dst[render.back], 0, 0, 0, 0, 0, 0, render.framebuffer.width,
+			render.framebuffer.height);
+	}
+	else {
+		uint8_t *dst = (uint8_t *)render.data + render.back*render.framebuffer.size;
+		scaler_scale(dst, render.framebuffer.stride, dmg_buf, SCREEN_WIDTH, SCREEN_HEIGHT,
+			render.format_pal, formats[render.framebuffer.format].bpp, render.scale);
+	}
+
+	struct render_frame *frame = &render.frames[render.back];
+	frame->slot = render.back;
+	frame->seq = render.seq++;
+	frame->frame = frame_num;
+	frame->damage_y = first*render.scale;
+	frame->damage_height = (last-first+1)*render.scale;
+
+	render.back = atomic_exchange(&render.ready, render.back | FRAME_NEW) & ~FRAME_NEW;
+	eventfd_write(render.frame_ready_fd, 1);
 }
 
-void render_draw_framebuffer() {
-	pixman_image_composite32(PIXMAN_OP_SRC, render.src, nullptr,
-		render.dst, 0, 0, 0, 0, 0, 0, render.framebuffer.width,
-		render.framebuffer.height);
+const struct render_frame *render_swap_frame(int slot) {
+	if (!(atomic_load(&render.ready) & FRAME_NEW)) {
+		return nullptr;
+	}
+	uint32_t ready = atomic_exchange(&render.ready, slot) & ~FRAME_NEW;
+	return &render.frames[ready];
 }
 
 struct framebuffer render_get_framebuffer_dimensions() {
@@ -59,19 +169,50 @@ int render_get_framebuffer_fd() {
 	return render.framebuffer_fd;
 }
 
+int render_get_frame_ready_fd() {
+	return render.frame_ready_fd;
+}
+
 void render_fini() {
 	pixman_image_set_transform(render.src, NULL);
 	free(render.src);
-	free(render.dst);
+	for (int i = 0; i < RENDER_NUM_FRAMES; i++) {
+		free(render.dst[i]);
+	}
 	free(dmg_buf);
-	munmap(render.data, render.framebuffer.size * sizeof(uint32_t));
+	free(render.prev_buf);
+	if (render.frame_ready_fd != -1)
+		close(render.frame_ready_fd);
+	munmap(render.data, render.framebuffer.size * RENDER_NUM_FRAMES);
 	close(render.framebuffer_fd);
 }
 
+int render_set_scale(int factor) {
+	if (factor < 1 || factor > SCALER_MAX_FACTOR) {
+		return -1;
+	}
+	render.scale = factor;
+	return 0;
+}
+
+void render_set_smooth(bool smooth) {
+	render.smooth = smooth;
+}
+
+void render_set_format(enum render_format format) {
+	render.framebuffer.format = format;
+}
+
 int render_init() {
-	render.framebuffer.width = 160*4;
-	render.framebuffer.height = 144*4;
-	render.framebuffer.stride = render.framebuffer.width * (32 / 8);
+	enum render_format format = render.framebuffer.format;
+	for (int i = 0; i < 4; i++) {
+		render.format_pal[i] = to_format(color_pal[i], format);
+	}
+
+	render.framebuffer.width = SCREEN_WIDTH*render.scale;
+	render.framebuffer.height = SCREEN_HEIGHT*render.scale;
+	// shm buffers want 4-byte aligned strides.
+	render.framebuffer.stride = (render.framebuffer.width * formats[format].bpp + 3) & ~3;
 	render.framebuffer.size = render.framebuffer.stride * render.framebuffer.height;
 	render.framebuffer_fd = memfd_create("realboy-bg", MFD_CLOEXEC);
 	if (render.framebuffer_fd == -1) {
@@ -80,36 +221,50 @@ int render_init() {
 	}
 
 	struct framebuffer *framebuf = &render.framebuffer;
-	if (posix_fallocate(render.framebuffer_fd, 0, framebuf->size * sizeof(uint32_t)) != 0) {
+	if (posix_fallocate(render.framebuffer_fd, 0, framebuf->size * RENDER_NUM_FRAMES) != 0) {
 		perror("posix_fallocate()");
 		goto err;
 	}
-	render.data = mmap(NULL, framebuf->size * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+	render.data = mmap(NULL, framebuf->size * RENDER_NUM_FRAMES, PROT_READ | PROT_WRITE, MAP_SHARED,
 		render.framebuffer_fd, 0);
 	if (render.data == MAP_FAILED) {
 		perror("mmap()");
 		goto err;
 	}
-	void *src = malloc(framebuf->size * sizeof(uint32_t));
-	if (!src) {
-		perror("malloc()");
+	dmg_buf = calloc(SCREEN_WIDTH*SCREEN_HEIGHT, sizeof(uint8_t));
+	render.prev_buf = calloc(SCREEN_WIDTH*SCREEN_HEIGHT, sizeof(uint8_t));
+	if (!dmg_buf || !render.prev_buf) {
+		perror("calloc()");
 		goto err;
 	}
-	dmg_buf = src;
-	render.src = pixman_image_create_bits(PIXMAN_x8r8g8b8, 160, 144, src, 160*(32/8));
-	if (!render.src) {
-		perror("pixman_image_create_bits()");
+	render.frame_ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (render.frame_ready_fd == -1) {
+		perror("eventfd()");
 		goto err;
 	}
-	render.dst = pixman_image_create_bits(PIXMAN_x8r8g8b8, framebuf->width, framebuf->height, render.data, framebuf->stride);
-	if (!render.dst) {
+	render.src = pixman_image_create_bits(PIXMAN_c8, SCREEN_WIDTH, SCREEN_HEIGHT,
+		(uint32_t *)dmg_buf, SCREEN_WIDTH);
+	if (!render.src) {
 		perror("pixman_image_create_bits()");
 		goto err;
 	}
+	for (size_t i = 0; i < sizeof(color_pal)/sizeof(color_pal[0]); i++) {
+		render.palette.rgba[i] = 0xff000000 | color_pal[i];
+	}
+	pixman_image_set_indexed(render.src, &render.palette);
+	for (int i = 0; i < RENDER_NUM_FRAMES; i++) {
+		render.dst[i] = pixman_image_create_bits(formats[format].pixman_format, framebuf->width,
+			framebuf->height, (uint32_t *)((uint8_t *)render.data + i*framebuf->size),
+			framebuf->stride);
+		if (!render.dst[i]) {
+			perror("pixman_image_create_bits()");
+			goto err;
+		}
+	}
 
 	pixman_transform_t scale;
 	pixman_transform_init_identity(&scale);
-	pixman_transform_init_scale(&scale, (1<<16)/4, (1<<16)/4);
+	pixman_transform_init_scale(&scale, (1<<16)/render.scale, (1<<16)/render.scale);
 	pixman_image_set_transform(render.src, &scale);
 	pixman_image_set_filter(render.src, PIXMAN_FILTER_BILINEAR, nullptr, 0);
 
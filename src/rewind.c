@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rewind.h"
+
+#include "joypad.h"
+#include "monitor.h"
+
+#define REWIND_NUM_INPUTS 4096
+
+struct input {
+	uint64_t cycle;
+	uint8_t pressed;
+};
+
+typedef struct {
+	bool is_recording;
+	bool is_replaying;
+
+	// ring of snapshots.
+	size_t snapshot_size;
+	uint8_t *snapshots;
+	uint64_t snapshot_cycles[REWIND_NUM_SNAPSHOTS];
+	unsigned first_snapshot;
+	unsigned num_snapshots;
+	uint64_t next_snapshot_cycle;
+
+	// ring of joypad changes.
+	struct input inputs[REWIND_NUM_INPUTS];
+	unsigned first_input;
+	unsigned num_inputs;
+	uint8_t pressed;
+	// inputs before this were dropped, so snapshots before it can't be
+	// re-executed from.
+	uint64_t input_floor;
+} history_t;
+static history_t history;
+
+static unsigned snapshot_index(unsigned i) {
+	return (history.first_snapshot + i) % REWIND_NUM_SNAPSHOTS;
+}
+
+static struct input *get_input(unsigned i) {
+	return &history.inputs[(history.first_input + i) % REWIND_NUM_INPUTS];
+}
+
+int rewind_start() {
+	history.snapshot_size = monitor_save(nullptr);
+	history.snapshots = malloc(history.snapshot_size * REWIND_NUM_SNAPSHOTS);
+	if (!history.snapshots) {
+		perror("malloc()");
+		return -1;
+	}
+	history.pressed = joypad_get_state();
+	history.next_snapshot_cycle = monitor_get_cycle_count();
+	history.is_recording = true;
+	return 0;
+}
+
+void rewind_fini() {
+	free(history.snapshots);
+	history.snapshots = nullptr;
+	history.is_recording = false;
+}
+
+static void log_input(uint8_t pressed) {
+	if (history.num_inputs == REWIND_NUM_INPUTS) {
+		history.input_floor = get_input(0)->cycle + 1;
+		history.first_input = (history.first_input + 1) % REWIND_NUM_INPUTS;
+		history.num_inputs--;
+	}
+	*get_input(history.num_inputs++) = (struct input){
+		.cycle = monitor_get_cycle_count(),
+		.pressed = pressed
+	};
+	history.pressed = pressed;
+}
+
+static void take_snapshot() {
+	if (history.num_snapshots == REWIND_NUM_SNAPSHOTS) {
+		history.first_snapshot = (history.first_snapshot + 1) % REWIND_NUM_SNAPSHOTS;
+		history.num_snapshots--;
+	}
+	unsigned i = snapshot_index(history.num_snapshots++);
+	monitor_save(history.snapshots + i*history.snapshot_size);
+	history.snapshot_cycles[i] = monitor_get_cycle_count();
+}
+
+void rewind_sync() {
+	if (!history.is_recording || history.is_replaying) {
+		return;
+	}
+	uint8_t pressed = joypad_get_state();
+	if (pressed != history.pressed) {
+		log_input(pressed);
+	}
+	uint64_t cycle = monitor_get_cycle_count();
+	if (cycle >= history.next_snapshot_cycle) {
+		take_snapshot();
+		history.next_snapshot_cycle = cycle + REWIND_INTERVAL;
+	}
+}
+
+int64_t rewind_seek(uint64_t cycle) {
+	for (unsigned n = history.num_snapshots; n > 0; n--) {
+		unsigned i = snapshot_index(n - 1);
+		uint64_t snapshot_cycle = history.snapshot_cycles[i];
+		if (snapshot_cycle < history.input_floor) {
+			break;
+		}
+		if (snapshot_cycle <= cycle) {
+			monitor_load(history.snapshots + i*history.snapshot_size);
+			history.is_replaying = true;
+			return snapshot_cycle;
+		}
+	}
+	return -1;
+}
+
+int64_t rewind_get_oldest() {
+	for (unsigned n = 0; n < history.num_snapshots; n++) {
+		uint64_t snapshot_cycle = history.snapshot_cycles[snapshot_index(n)];
+		if (snapshot_cycle >= history.input_floor) {
+			return snapshot_cycle;
+		}
+	}
+	return -1;
+}
+
+void rewind_done() {
+	uint64_t cycle = monitor_get_cycle_count();
+	while (history.num_snapshots &&
+			history.snapshot_cycles[snapshot_index(history.num_snapshots - 1)] > cycle) {
+		history.num_snapshots--;
+	}
+	while (history.num_inputs && get_input(history.num_inputs - 1)->cycle > cycle) {
+		history.num_inputs--;
+	}
+	history.pressed = joypad_get_state();
+	history.next_snapshot_cycle = history.num_snapshots ?
+		history.snapshot_cycles[snapshot_index(history.num_snapshots - 1)] + REWIND_INTERVAL : cycle;
+	history.is_replaying = false;
+}
+
+bool rewind_is_replaying() {
+	return history.is_replaying;
+}
+
+// the last change at or before the current cycle.
+uint8_t rewind_get_input() {
+	uint64_t cycle = monitor_get_cycle_count();
+	unsigned lo = 0, hi = history.num_inputs;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (get_input(mid)->cycle <= cycle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? get_input(lo - 1)->pressed : joypad_get_state();
+}
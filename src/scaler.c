@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2013-2016, 2025 Sergio Gómez Del Real
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#include "scaler.h"
+
+// each of these expands one row of shades to 'factor' times its width.
+// the remaining factor-1 rows are copies of the first one.
+typedef void (*scale_row_fn)(uint32_t *dst, const uint8_t *src, size_t width,
+	const uint32_t palette[4], int factor);
+
+// rgb565 goes through a plain loop; at two bytes per pixel the rows are
+// short enough that the stores aren't what costs.
+static void scale_row16(uint16_t *dst, const uint8_t *src, size_t width,
+		const uint32_t palette[4], int factor) {
+	for (size_t x = 0; x < width; x++) {
+		uint16_t color = palette[src[x]&3];
+		for (int i = 0; i < factor; i++) {
+			*dst++ = color;
+		}
+	}
+}
+
+static void scale_row_scalar(uint32_t *dst, const uint8_t *src, size_t width,
+		const uint32_t palette[4], int factor) {
+	for (size_t x = 0; x < width; x++) {
+		uint32_t color = palette[src[x]&3];
+		for (int i = 0; i < factor; i++) {
+			*dst++ = color;
+		}
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+// the vector versions look the colors up a vector of shades at a time (the
+// palette fits in a register), and then spread them out 'factor' times
+// with a shuffle per output vector; the stores are as few as they can be,
+// a full vector each.
+// the last few pixels, which don't make up a whole vector, are left to the
+// scalar version.
+
+// for each factor, which source lane goes to each lane of the k-th output
+// vector.
+static uint8_t spread_ssse3[SCALER_MAX_FACTOR+1][SCALER_MAX_FACTOR][4];
+static int32_t spread_avx2[SCALER_MAX_FACTOR+1][SCALER_MAX_FACTOR][8];
+
+static void init_spreads() {
+	for (int factor = 1; factor <= SCALER_MAX_FACTOR; factor++) {
+		for (int k = 0; k < factor; k++) {
+			for (int i = 0; i < 4; i++)
+				spread_ssse3[factor][k][i] = (4*k + i) / factor;
+			for (int i = 0; i < 8; i++)
+				spread_avx2[factor][k][i] = (8*k + i) / factor;
+		}
+	}
+}
+
+// four pixels at a time; the colors are picked byte by byte out of the
+// palette with pshufb.
+__attribute__((target("ssse3")))
+static void scale_row_ssse3(uint32_t *dst, const uint8_t *src, size_t width,
+		const uint32_t palette[4], int factor) {
+	__m128i pal = _mm_loadu_si128((const __m128i *)palette);
+	__m128i shade_mask = _mm_set1_epi8(3);
+	__m128i byte_offsets = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+	__m128i spreads[SCALER_MAX_FACTOR];
+	for (int k = 0; k < factor; k++) {
+		// each lane's shade, to all four of its bytes.
+		uint8_t bytes[16];
+		for (int i = 0; i < 16; i++)
+			bytes[i] = spread_ssse3[factor][k][i/4];
+		spreads[k] = _mm_loadu_si128((const __m128i *)bytes);
+	}
+
+	size_t x;
+	for (x = 0; x + 4 <= width; x += 4) {
+		uint32_t four;
+		memcpy(&four, src + x, sizeof(four));
+		__m128i shades = _mm_cvtsi32_si128(four);
+		for (int k = 0; k < factor; k++) {
+			__m128i idx = _mm_and_si128(_mm_shuffle_epi8(shades, spreads[k]), shade_mask);
+			// shade s takes bytes 4s to 4s+3 of the palette.
+			idx = _mm_add_epi8(_mm_slli_epi16(idx, 2), byte_offsets);
+			_mm_storeu_si128((__m128i *)(dst + x*factor + 4*k), _mm_shuffle_epi8(pal, idx));
+		}
+	}
+	scale_row_scalar(dst + x*factor, src + x, width - x, palette, factor);
+}
+
+// eight pixels at a time, with vpermd for both the lookup and the spreading.
+__attribute__((target("avx2")))
+static void scale_row_avx2(uint32_t *dst, const uint8_t *src, size_t width,
+		const uint32_t palette[4], int factor) {
+	__m256i pal = _mm256_setr_epi32(palette[0], palette[1], palette[2], palette[3],
+		palette[0], palette[1], palette[2], palette[3]);
+	__m256i shade_mask = _mm256_set1_epi32(3);
+	__m256i spreads[SCALER_MAX_FACTOR];
+	for (int k = 0; k < factor; k++) {
+		spreads[k] = _mm256_loadu_si256((const __m256i *)spread_avx2[factor][k]);
+	}
+
+	size_t x;
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i shades = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+		__m256i colors = _mm256_permutevar8x32_epi32(pal, _mm256_and_si256(shades, shade_mask));
+		if (factor == 1) {
+			_mm256_storeu_si256((__m256i *)(dst + x), colors);
+			continue;
+		}
+		for (int k = 0; k < factor; k++) {
+			_mm256_storeu_si256((__m256i *)(dst + x*factor + 8*k),
+				_mm256_permutevar8x32_epi32(colors, spreads[k]));
+		}
+	}
+	scale_row_scalar(dst + x*factor, src + x, width - x, palette, factor);
+}
+#endif
+
+static scale_row_fn get_scale_row() {
+	static scale_row_fn scale_row;
+
+	if (!scale_row) {
+#ifdef HAVE_X86_SIMD
+		init_spreads();
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			scale_row = scale_row_avx2;
+		else if (__builtin_cpu_supports("ssse3"))
+			scale_row = scale_row_ssse3;
+		else
+#endif
+			scale_row = scale_row_scalar;
+	}
+	return scale_row;
+}
+
+void scaler_scale(void *dst, size_t dst_stride, const uint8_t *src, size_t width,
+		size_t height, const uint32_t palette[4], int bpp, int factor) {
+	assert(factor >= 1 && factor <= SCALER_MAX_FACTOR);
+	assert(bpp == 2 || bpp == 4);
+
+	scale_row_fn scale_row = get_scale_row();
+	size_t row_size = width * factor * bpp;
+	for (size_t y = 0; y < height; y++) {
+		uint8_t *row = (uint8_t *)dst + y*factor*dst_stride;
+		switch (bpp) {
+			case 2:
+				scale_row16((uint16_t *)row, src + y*width, width, palette, factor);
+				break;
+			default:
+				scale_row((uint32_t *)row, src + y*width, width, palette, factor);
+		}
+		for (int i = 1; i < factor; i++) {
+			memcpy(row + i*dst_stride, row, row_size);
+		}
+	}
+}
@@ -22,31 +22,99 @@
 
 #include "config.h"
 
-#ifdef HAVE_LIBEMU
-#include <libemu.h>
-#include <pthread.h>
-#include <stdio.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+
 #include "cpu.h"
+#include "expr.h"
+#include "monitor.h"
 #include "ppu.h"
+#include "rewind.h"
+
+#ifdef HAVE_LIBEMU
+#include <libemu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "liveview.h"
 #endif
 
-static list_t *breakpoint_list;
+// breakpoints, and logpoints, which log the machine state (see the log below)
+// instead of stopping.
+// addresses are in the low 16 bits and, for the switchable rom area
+// (0x4000-0x7fff), optionally a rom bank in the high 16 bits (0 for any
+// bank).
+// either may have a condition (see expr.h), which must hold for them to apply.
+struct breakpoint {
+	uint32_t addr;
+	bool is_logpoint;
+	// logged along with the registers.
+	uint16_t mem_addr;
+	uint16_t mem_len;
+	size_t cond_len; // 0 if none
+	uint8_t cond[];
+};
+static list_t *breakpoint_list; // of struct breakpoint *
+// one bit per address with a breakpoint, whatever its bank; checked after
+// every instruction, so that addresses without breakpoints cost a bit test.
+static uint64_t breakpoint_bitmap[0x10000/64];
 static uint16_t until_addr;
 static bool control_flow_continue;
 static bool control_flow_until;
 static bool control_flow_next;
 
+// server-side runs, which reply once they're done (or hit a breakpoint).
+enum run_target {
+	RUN_NONE,
+	RUN_STEPS, // CONTROL_FLOW_STEP: u32 instructions
+	RUN_CYCLES, // CONTROL_FLOW_RUN_CYCLES: u32 m-cycles
+	RUN_FRAME, // CONTROL_FLOW_RUN_FRAME: to the start of the next frame
+	RUN_SCANLINE, // CONTROL_FLOW_RUN_SCANLINE: to the next scanline, or to u32 ly
+	RUN_STEP_OVER // CONTROL_FLOW_STEP_OVER: one instruction, or a whole call/rst
+};
+static struct {
+	enum run_target target;
+	uint32_t subtype; // of the request, for the reply
+	uint64_t steps;
+	uint64_t cycle_end;
+	uint64_t frame;
+	uint8_t ly;
+	bool is_any_line;
+	uint16_t return_addr;
+	uint16_t sp;
+} run;
+
 static bool client_connected;
+// only touched by the emulation thread.
 static bool server_running;
-static bool server_stop_request;
 
-pthread_mutex_t mtx_server = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cnd_server_stop = PTHREAD_COND_INITIALIZER;
-pthread_rwlock_t quick_lock = PTHREAD_RWLOCK_INITIALIZER;
+#ifdef HAVE_LIBEMU
+// requests are received by the io thread, and handed over to the emulation
+// thread, which is the only one that touches the machine or replies to the
+// client.
+// while running, the emulation thread only looks at the queue at sync points
+// (see monitor_run()); while stopped, it sleeps on 'wakeup_fd' until there's
+// something in it.
+#define REQUEST_QUEUE_SIZE 64
+#define REQUEST_QUEUE_MASK (REQUEST_QUEUE_SIZE-1)
+static struct {
+	// single producer (the io thread), single consumer (the emulation).
+	struct msg queue[REQUEST_QUEUE_SIZE];
+	_Atomic uint32_t head; // written by the producer
+	_Atomic uint32_t tail; // written by the consumer
+	int wakeup_fd; // eventfd
+} requests = { .wakeup_fd = -1 };
+#endif
+
+// the instruction being executed, for watch hits.
+static uint16_t insn_pc;
 
 static void resume_execution() {
+	insn_pc = cpu_get_pc();
 	server_running = true;
 }
 
@@ -73,18 +141,352 @@ static void handle_control_flow_next() {
 	resume_execution();
 }
 
-static void handle_control_flow_break(uint32_t addr) {
-	list_add(breakpoint_list, (uintptr_t)addr);
+static uint16_t get_cpu_reg(enum cpu_reg reg) {
+	uint32_t value = 0;
+	struct peek peek = { .type = PEEK_CPU, .subtype = CPU_PEEK_REG, .req = reg };
+	struct peek_reply peek_reply = { .capacity = sizeof(value), .payload = &value };
+	cpu_peek(&peek, &peek_reply);
+	return value;
+}
+
+static void start_run(enum run_target target, uint32_t subtype, uint32_t arg, bool has_arg) {
+	run.target = target;
+	run.subtype = subtype;
+	switch (target) {
+		case RUN_STEPS:
+			run.steps = arg ? arg : 1;
+			break;
+		case RUN_CYCLES:
+			run.cycle_end = monitor_get_cycle_count() + arg;
+			break;
+		case RUN_FRAME:
+			run.frame = ppu_get_frame_count();
+			break;
+		case RUN_SCANLINE:
+			run.is_any_line = !has_arg;
+			run.ly = has_arg ? arg : ppu_rd(0xff44);
+			break;
+		case RUN_STEP_OVER:
+			uint16_t pc = get_cpu_reg(CPU_REG_PC);
+			uint8_t op = monitor_peek_mem(pc);
+			bool is_call = op == 0xcd || op == 0xc4 || op == 0xcc || op == 0xd4 || op == 0xdc;
+			bool is_rst = (op & 0xc7) == 0xc7;
+			if (is_call || is_rst) {
+				run.return_addr = pc + (is_call ? 3 : 1);
+				run.sp = get_cpu_reg(CPU_REG_SP);
+			}
+			else {
+				run.target = RUN_STEPS;
+				run.steps = 1;
+			}
+			break;
+		default:
+	}
+	resume_execution();
+}
+
+static bool is_run_done(uint16_t pc) {
+	switch (run.target) {
+		case RUN_STEPS:
+			return --run.steps == 0;
+		case RUN_CYCLES:
+			return monitor_get_cycle_count() >= run.cycle_end;
+		case RUN_FRAME:
+			return ppu_get_frame_count() != run.frame;
+		case RUN_SCANLINE:
+			uint8_t ly = ppu_rd(0xff44);
+			return run.is_any_line ? ly != run.ly : ly == run.ly;
+		case RUN_STEP_OVER:
+			// back from the call, and not from a deeper recursion of it.
+			return pc == run.return_addr && get_cpu_reg(CPU_REG_SP) >= run.sp;
+		default:
+			return false;
+	}
+}
+
+static bool is_breakpoint_addr(uint16_t addr) {
+	return breakpoint_bitmap[addr/64] & (1ULL << (addr%64));
+}
+
+static void update_breakpoint_bitmap() {
+	memset(breakpoint_bitmap, 0, sizeof(breakpoint_bitmap));
+	for (int i = 0; i < breakpoint_list->length; i++) {
+		struct breakpoint *breakpoint = (struct breakpoint *)breakpoint_list->items[i];
+		uint16_t addr = breakpoint->addr;
+		breakpoint_bitmap[addr/64] |= 1ULL << (addr%64);
+	}
+}
+
+static void add_breakpoint(struct breakpoint *tmpl, const uint8_t *cond, size_t cond_len) {
+	if (cond_len && expr_check(cond, cond_len) == -1) {
+		return;
+	}
+	struct breakpoint *breakpoint = malloc(sizeof(*breakpoint) + cond_len);
+	if (!breakpoint) {
+		perror("malloc()");
+		return;
+	}
+	*breakpoint = *tmpl;
+	breakpoint->cond_len = cond_len;
+	memcpy(breakpoint->cond, cond, cond_len);
+
+	list_add(breakpoint_list, (uintptr_t)breakpoint);
+	update_breakpoint_bitmap();
+}
+
+// CONTROL_FLOW_BREAK: u32 addr, then the condition, if any.
+static void handle_control_flow_break(const uint8_t *payload, size_t size) {
+	if (size < sizeof(uint32_t)) {
+		return;
+	}
+	struct breakpoint tmpl = {};
+	memcpy(&tmpl.addr, payload, sizeof(uint32_t));
+	add_breakpoint(&tmpl, payload + sizeof(uint32_t), size - sizeof(uint32_t));
 }
 
 static void handle_control_flow_delete(uint32_t addr) {
-	uint32_t breakpoint;
-	list_for_each(breakpoint_list, breakpoint) {
-		if (breakpoint == addr || addr == 0) {
-			list_remove(breakpoint_list, breakpoint);
+	for (int i = 0; i < breakpoint_list->length; i++) {
+		struct breakpoint *breakpoint = (struct breakpoint *)breakpoint_list->items[i];
+		if (breakpoint->addr == addr || addr == 0) {
+			list_del(breakpoint_list, i);
+			free(breakpoint);
 			break;
 		}
 	}
+	update_breakpoint_bitmap();
+}
+
+// the log.
+// logpoints append entries to a ring, which the client drains whenever it
+// wants, even while running (MONITOR_DRAIN_LOG). entries that don't fit are
+// dropped, and counted.
+#define LOG_RING_SIZE 256
+#define LOGPOINT_MEM_MAX 32
+
+struct log_entry {
+	uint64_t cycle;
+	uint32_t addr; // of the logpoint
+	uint16_t mem_addr;
+	uint16_t mem_len;
+	uint16_t regs[6]; // af, bc, de, hl, sp, pc
+	uint8_t reserved[4];
+	uint8_t mem[LOGPOINT_MEM_MAX];
+};
+
+static struct {
+	struct log_entry entries[LOG_RING_SIZE];
+	// logpoints append, MONITOR_DRAIN_LOG consumes; both on the emulation thread.
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;
+} log_ring;
+
+static void log_append(struct breakpoint *logpoint) {
+	unsigned head = atomic_load_explicit(&log_ring.head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&log_ring.tail, memory_order_acquire) == LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&log_ring.dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	struct log_entry *entry = &log_ring.entries[head % LOG_RING_SIZE];
+	entry->cycle = monitor_get_cycle_count();
+	entry->addr = logpoint->addr;
+	for (enum cpu_reg reg = CPU_REG_AF; reg <= CPU_REG_PC; reg++) {
+		entry->regs[reg - CPU_REG_AF] = get_cpu_reg(reg);
+	}
+	entry->mem_addr = logpoint->mem_addr;
+	entry->mem_len = logpoint->mem_len;
+	for (uint16_t i = 0; i < logpoint->mem_len; i++) {
+		entry->mem[i] = monitor_peek_mem(logpoint->mem_addr + i);
+	}
+
+	atomic_store_explicit(&log_ring.head, head + 1, memory_order_release);
+}
+
+// CONTROL_FLOW_LOGPOINT: u32 addr, u16 mem_addr, u16 mem_len (up to
+// LOGPOINT_MEM_MAX), then the condition, if any.
+static void handle_control_flow_logpoint(const uint8_t *payload, size_t size) {
+	size_t hdr_size = sizeof(uint32_t) + 2*sizeof(uint16_t);
+	if (size < hdr_size) {
+		return;
+	}
+	struct breakpoint tmpl = { .is_logpoint = true };
+	memcpy(&tmpl.addr, payload, sizeof(uint32_t));
+	memcpy(&tmpl.mem_addr, payload + sizeof(uint32_t), sizeof(uint16_t));
+	memcpy(&tmpl.mem_len, payload + sizeof(uint32_t) + sizeof(uint16_t), sizeof(uint16_t));
+	if (tmpl.mem_len > LOGPOINT_MEM_MAX) {
+		fprintf(stderr, "error: handle_control_flow_logpoint(): too much memory to log\n");
+		return;
+	}
+	add_breakpoint(&tmpl, payload + hdr_size, size - hdr_size);
+}
+
+// watchpoints, on reads, writes or execution of an address range, with an
+// optional condition on the access (EXPR_ACCESS_ADDR, EXPR_ACCESS_VALUE).
+// only pages with a watch have their accesses checked (see
+// monitor_set_watch_page()); execution is checked here, per page of pc.
+struct watchpoint {
+	uint16_t addr;
+	uint16_t len;
+	uint8_t kinds; // enum monitor_watch
+	size_t cond_len;
+	uint8_t cond[];
+};
+static list_t *watchpoint_list; // of struct watchpoint *
+static uint8_t watch_exec_pages[0x100];
+
+// reported with CONTROL_FLOW_WATCH when stopping on a watch.
+struct watch_hit {
+	uint64_t cycle; // at the start of the instruction
+	uint16_t pc; // of the instruction
+	uint16_t addr;
+	uint8_t old_value;
+	uint8_t new_value;
+	uint8_t kind; // enum monitor_watch
+	uint8_t reserved;
+};
+static struct watch_hit watch_hit;
+static bool is_watch_hit;
+
+// while re-executing for reverse execution, watches and logpoints are off;
+// only writes to 'addr' are looked for, when running back to the last one.
+static struct {
+	bool is_active;
+	bool is_write_watch;
+	uint16_t addr;
+	bool is_write;
+} reverse;
+
+static void update_watch_pages() {
+	uint8_t pages[0x100] = {};
+	for (int i = 0; i < watchpoint_list->length; i++) {
+		struct watchpoint *watchpoint = (struct watchpoint *)watchpoint_list->items[i];
+		uint32_t end = (uint32_t)watchpoint->addr + watchpoint->len - 1;
+		for (uint32_t page = watchpoint->addr >> 8; page <= end >> 8; page++) {
+			pages[page] |= watchpoint->kinds;
+		}
+	}
+	for (int page = 0; page < 0x100; page++) {
+		monitor_set_watch_page(page, pages[page] & (MONITOR_WATCH_READ | MONITOR_WATCH_WRITE));
+		watch_exec_pages[page] = pages[page] & MONITOR_WATCH_EXEC;
+	}
+}
+
+// the first access that hits a watch, per instruction.
+static void check_watchpoints(enum monitor_watch kind, uint16_t addr, uint8_t old_value,
+		uint8_t new_value) {
+	if (reverse.is_active) {
+		if (kind == MONITOR_WATCH_WRITE && reverse.is_write_watch && addr == reverse.addr) {
+			reverse.is_write = true;
+		}
+		return;
+	}
+	if (is_watch_hit) {
+		return;
+	}
+	for (int i = 0; i < watchpoint_list->length; i++) {
+		struct watchpoint *watchpoint = (struct watchpoint *)watchpoint_list->items[i];
+		if (!(watchpoint->kinds & kind) || addr < watchpoint->addr ||
+				addr - watchpoint->addr >= watchpoint->len) {
+			continue;
+		}
+		struct expr_access access = { .addr = addr, .value = new_value };
+		if (watchpoint->cond_len && !expr_eval(watchpoint->cond, &access)) {
+			continue;
+		}
+		watch_hit = (struct watch_hit){
+			.cycle = monitor_get_cycle_count(),
+			.pc = kind == MONITOR_WATCH_EXEC ? addr : insn_pc,
+			.addr = addr,
+			.old_value = old_value,
+			.new_value = new_value,
+			.kind = kind
+		};
+		is_watch_hit = true;
+		return;
+	}
+}
+
+// CONTROL_FLOW_WATCH: u16 addr, u16 len, u8 kinds (enum monitor_watch), then
+// the condition, if any.
+static void handle_control_flow_watch(const uint8_t *payload, size_t size) {
+	size_t hdr_size = 2*sizeof(uint16_t) + sizeof(uint8_t);
+	if (size < hdr_size) {
+		return;
+	}
+	uint16_t addr, len;
+	memcpy(&addr, payload, sizeof(addr));
+	memcpy(&len, payload + sizeof(addr), sizeof(len));
+	uint8_t kinds = payload[2*sizeof(uint16_t)];
+	const uint8_t *cond = payload + hdr_size;
+	size_t cond_len = size - hdr_size;
+	if (!len || addr + len > 0x10000 || !kinds) {
+		fprintf(stderr, "error: handle_control_flow_watch(): bad watch\n");
+		return;
+	}
+	if (cond_len && expr_check(cond, cond_len) == -1) {
+		return;
+	}
+
+	struct watchpoint *watchpoint = malloc(sizeof(*watchpoint) + cond_len);
+	if (!watchpoint) {
+		perror("malloc()");
+		return;
+	}
+	watchpoint->addr = addr;
+	watchpoint->len = len;
+	watchpoint->kinds = kinds;
+	watchpoint->cond_len = cond_len;
+	memcpy(watchpoint->cond, cond, cond_len);
+	list_add(watchpoint_list, (uintptr_t)watchpoint);
+	update_watch_pages();
+}
+
+// CONTROL_FLOW_DELETE_WATCH: u32 addr, for the watches starting there; all of
+// them if none.
+static void handle_control_flow_delete_watch(const uint8_t *payload, size_t size) {
+	bool is_all = size < sizeof(uint32_t);
+	uint32_t addr = 0;
+	if (!is_all)
+		memcpy(&addr, payload, sizeof(addr));
+
+	for (int i = 0; i < watchpoint_list->length;) {
+		struct watchpoint *watchpoint = (struct watchpoint *)watchpoint_list->items[i];
+		if (is_all || watchpoint->addr == addr) {
+			list_del(watchpoint_list, i);
+			free(watchpoint);
+		}
+		else {
+			i++;
+		}
+	}
+	update_watch_pages();
+}
+
+// the breakpoints at 'pc' that apply (rom bank, condition): logpoints get
+// logged, and the return value tells whether there's one to stop at.
+static bool check_breakpoints(uint16_t pc) {
+	bool is_hit = false;
+	uint16_t bank = pc >= 0x4000 && pc <= 0x7fff ? monitor_get_rom_bank() : 0;
+	for (int i = 0; i < breakpoint_list->length; i++) {
+		struct breakpoint *breakpoint = (struct breakpoint *)breakpoint_list->items[i];
+		uint16_t breakpoint_bank = breakpoint->addr >> 16;
+		if ((breakpoint->addr & 0xffff) != pc || (bank && breakpoint_bank && breakpoint_bank != bank)) {
+			continue;
+		}
+		if (breakpoint->cond_len && !expr_eval(breakpoint->cond, nullptr)) {
+			continue;
+		}
+		if (breakpoint->is_logpoint) {
+			if (!reverse.is_active) {
+				log_append(breakpoint);
+			}
+		}
+		else {
+			is_hit = true;
+		}
+	}
+	return is_hit;
 }
 
 static void handle_control_flow_continue() {
@@ -93,6 +495,302 @@ static void handle_control_flow_continue() {
 }
 
 #ifdef HAVE_LIBEMU
+// pass 'fd' to the client, as SCM_RIGHTS ancillary data on a 1-byte message
+// right after the reply.
+static int send_fd(int fd) {
+	char byte = 0;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control = {};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(emu_get_fd(), &msg, MSG_NOSIGNAL) == -1) {
+		perror("sendmsg()");
+		return -1;
+	}
+	return 0;
+}
+
+// MONITOR_GET_LIVE_VIEW: the reply holds the u32 size of the live view (0 if
+// there's none), and the memfd follows (see send_fd()).
+// it may be requested while running.
+static int handle_monitor_get_live_view() {
+	int fd = liveview_get_fd();
+	uint32_t size = fd == -1 ? 0 : liveview_get_size();
+
+	struct msg answer = {};
+	answer.hdr.type = TYPE_MONITOR;
+	answer.hdr.subtype.monitor = MONITOR_GET_LIVE_VIEW;
+	answer.hdr.size = sizeof(size);
+	answer.payload = &size;
+	if (emu_send_msg(&answer) == -1) {
+		return -1;
+	}
+	return fd == -1 ? 0 : send_fd(fd);
+}
+
+// memory subscriptions.
+// the client subscribes to memory ranges while stopped (MONITOR_SUBSCRIBE_MEM,
+// with an array of {u32 addr, u32 len}; none to unsubscribe), and right then
+// and on every stop gets a
+// MONITOR_MEM_DELTA with what changed in them since the previous one (all of
+// it the first time).
+// the delta is a sequence of runs: u16 addr, u16 len, then the 'len' bytes
+// at 'addr'. runs cover small unchanged gaps rather than starting anew.
+#define MAX_MEM_SUBSCRIPTIONS 16
+#define DELTA_RUN_HDR (2*sizeof(uint16_t))
+#define DELTA_MAX_RUN 0xffff
+
+static struct {
+	uint16_t addr;
+	uint32_t len;
+} mem_subscriptions[MAX_MEM_SUBSCRIPTIONS];
+static int num_mem_subscriptions;
+static bool is_mem_shadow_valid;
+// what the client was sent last, and what there is now.
+static uint8_t mem_shadow[0x10000];
+static uint8_t mem_current[0x10000];
+static uint8_t mem_delta[0x10000 + MAX_MEM_SUBSCRIPTIONS*DELTA_RUN_HDR];
+
+static bool is_mem_changed(uint32_t addr) {
+	return !is_mem_shadow_valid || mem_current[addr] != mem_shadow[addr];
+}
+
+static size_t encode_mem_delta(uint8_t *out, uint32_t base, uint32_t len) {
+	size_t size = 0;
+	uint32_t i = 0;
+	while (i < len) {
+		if (!is_mem_changed(base + i)) {
+			i++;
+			continue;
+		}
+		uint32_t end = i + 1;
+		for (uint32_t j = end; j < len && j < i + DELTA_MAX_RUN && j - end < DELTA_RUN_HDR; j++) {
+			if (is_mem_changed(base + j))
+				end = j + 1;
+		}
+		uint16_t hdr[2] = { base + i, end - i };
+		memcpy(out + size, hdr, sizeof(hdr));
+		memcpy(out + size + sizeof(hdr), &mem_current[base + i], end - i);
+		size += sizeof(hdr) + end - i;
+		i = end;
+	}
+	return size;
+}
+
+// on every stop; like everything that talks to the client, on the emulation
+// thread.
+static void push_mem_delta() {
+	if (!num_mem_subscriptions) {
+		return;
+	}
+
+	size_t size = 0;
+	for (int i = 0; i < num_mem_subscriptions; i++) {
+		uint32_t addr = mem_subscriptions[i].addr, len = mem_subscriptions[i].len;
+		struct peek peek = {
+			.type = PEEK_CPU,
+			.subtype = CPU_PEEK_MEM,
+			.req = addr,
+			.len = len
+		};
+		struct peek_reply peek_reply = {
+			.capacity = len,
+			.payload = &mem_current[addr]
+		};
+		cpu_peek(&peek, &peek_reply);
+		size += encode_mem_delta(mem_delta + size, addr, len);
+	}
+	for (int i = 0; i < num_mem_subscriptions; i++) {
+		uint32_t addr = mem_subscriptions[i].addr, len = mem_subscriptions[i].len;
+		memcpy(&mem_shadow[addr], &mem_current[addr], len);
+	}
+	is_mem_shadow_valid = true;
+
+	struct msg msg = {};
+	msg.hdr.type = TYPE_MONITOR;
+	msg.hdr.subtype.monitor = MONITOR_MEM_DELTA;
+	msg.hdr.size = size;
+	msg.payload = mem_delta;
+	emu_send_msg(&msg);
+}
+
+static void handle_monitor_subscribe_mem(struct msg *req) {
+	uint32_t (*ranges)[2] = req->payload;
+	size_t num = req->hdr.size / sizeof(*ranges);
+	if (num > MAX_MEM_SUBSCRIPTIONS) {
+		fprintf(stderr, "error: handle_monitor_subscribe_mem(): too many ranges\n");
+		return;
+	}
+
+	uint32_t total = 0;
+	for (size_t i = 0; i < num; i++) {
+		uint32_t addr = ranges[i][0], len = ranges[i][1];
+		if (!len || addr >= 0x10000 || len > 0x10000 - addr) {
+			fprintf(stderr, "error: handle_monitor_subscribe_mem(): bad range\n");
+			return;
+		}
+		total += len;
+		if (total > 0x10000) {
+			fprintf(stderr, "error: handle_monitor_subscribe_mem(): bad range\n");
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		mem_subscriptions[i].addr = ranges[i][0];
+		mem_subscriptions[i].len = ranges[i][1];
+	}
+	num_mem_subscriptions = num;
+	is_mem_shadow_valid = false;
+	push_mem_delta();
+}
+
+// MONITOR_DRAIN_LOG: the reply holds the u32 count of entries dropped since
+// the previous drain, then the entries (struct log_entry) logged since.
+// it may be requested while running.
+static int handle_monitor_drain_log() {
+	static uint8_t reply[sizeof(uint32_t) + sizeof(struct log_entry)*LOG_RING_SIZE];
+
+	unsigned tail = atomic_load_explicit(&log_ring.tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&log_ring.head, memory_order_acquire);
+	uint32_t dropped = atomic_exchange_explicit(&log_ring.dropped, 0, memory_order_relaxed);
+
+	memcpy(reply, &dropped, sizeof(dropped));
+	size_t size = sizeof(dropped);
+	for (; tail != head; tail++) {
+		memcpy(reply + size, &log_ring.entries[tail % LOG_RING_SIZE], sizeof(struct log_entry));
+		size += sizeof(struct log_entry);
+	}
+	atomic_store_explicit(&log_ring.tail, tail, memory_order_release);
+
+	struct msg answer = {};
+	answer.hdr.type = TYPE_MONITOR;
+	answer.hdr.subtype.monitor = MONITOR_DRAIN_LOG;
+	answer.hdr.size = size;
+	answer.payload = reply;
+	return emu_send_msg(&answer);
+}
+
+// reverse execution: the machine goes back to a snapshot (see rewind.h), and
+// is re-executed from there, one instruction at a time, looking for the last
+// point of interest before where it was.
+enum reverse_target {
+	REVERSE_STEP, // CONTROL_FLOW_REVERSE_STEP: the previous instruction
+	REVERSE_CONTINUE, // CONTROL_FLOW_REVERSE_CONTINUE: the previous breakpoint hit
+	REVERSE_TO_WRITE // CONTROL_FLOW_REVERSE_TO_WRITE: u32 addr, the last instruction that wrote it
+};
+
+enum reverse_status {
+	REVERSE_DONE,
+	// the history doesn't go back that far; stopped at its beginning.
+	REVERSE_AT_OLDEST
+};
+
+// replied with the subtype of the request.
+struct reverse_reply {
+	uint32_t pc;
+	uint32_t status; // enum reverse_status
+};
+
+static void replay_to(uint64_t cycle) {
+	while (monitor_get_cycle_count() < cycle) {
+		monitor_step();
+	}
+}
+
+// re-execute up to 'end', returning the cycle of the last instruction
+// (at its start) that is a hit; -1 if none.
+static int64_t find_last_hit(enum reverse_target target, uint64_t end) {
+	int64_t hit = -1;
+	for (uint64_t cycle = monitor_get_cycle_count(); cycle < end;
+			cycle = monitor_get_cycle_count()) {
+		uint16_t pc = cpu_get_pc();
+		if (target == REVERSE_STEP ||
+				(target == REVERSE_CONTINUE && is_breakpoint_addr(pc) && check_breakpoints(pc))) {
+			hit = cycle;
+		}
+		reverse.is_write = false;
+		monitor_step();
+		if (reverse.is_write) {
+			hit = cycle;
+		}
+	}
+	return hit;
+}
+
+static enum reverse_status reverse_to(enum reverse_target target) {
+	enum reverse_status status = REVERSE_AT_OLDEST;
+	bool was_throttled = monitor_is_throttled();
+	monitor_set_throttle(false);
+	reverse.is_active = true;
+
+	// one snapshot interval at a time, latest first.
+	uint64_t end = monitor_get_cycle_count();
+	int64_t start;
+	while (end && (start = rewind_seek(end - 1)) != -1) {
+		int64_t hit = find_last_hit(target, end);
+		if (hit != -1) {
+			rewind_seek(hit);
+			replay_to(hit);
+			status = REVERSE_DONE;
+			break;
+		}
+		end = start;
+	}
+	if (status == REVERSE_AT_OLDEST) {
+		int64_t oldest = rewind_get_oldest();
+		if (oldest != -1) {
+			rewind_seek(oldest);
+		}
+	}
+
+	rewind_done();
+	reverse.is_active = false;
+	monitor_set_throttle(was_throttled);
+	return status;
+}
+
+static void handle_control_flow_reverse(uint32_t subtype, enum reverse_target target,
+		uint32_t addr) {
+	if (target == REVERSE_TO_WRITE) {
+		if (addr > 0xffff) {
+			fprintf(stderr, "error: handle_control_flow_reverse(): bad address\n");
+			return;
+		}
+		reverse.is_write_watch = true;
+		reverse.addr = addr;
+		monitor_set_watch_page(addr >> 8, MONITOR_WATCH_WRITE);
+	}
+	struct reverse_reply reply = { .status = reverse_to(target) };
+	if (target == REVERSE_TO_WRITE) {
+		reverse.is_write_watch = false;
+		update_watch_pages();
+	}
+	reply.pc = cpu_get_pc();
+	insn_pc = reply.pc;
+
+	struct msg msg_reply = {};
+	msg_reply.hdr.type = TYPE_CONTROL_FLOW;
+	msg_reply.hdr.subtype.control_flow = subtype;
+	msg_reply.hdr.size = sizeof(reply);
+	msg_reply.payload = &reply;
+	emu_send_msg(&msg_reply);
+	push_mem_delta();
+}
+
 static void dispatch_monitor(struct msg *req) {
 	switch (req->hdr.subtype.monitor) {
 		case MONITOR_STOP:
@@ -101,10 +799,16 @@ static void dispatch_monitor(struct msg *req) {
 		case MONITOR_RESUME:
 			handle_monitor_resume();
 			break;
+		case MONITOR_SUBSCRIBE_MEM:
+			handle_monitor_subscribe_mem(req);
+			break;
 	}
 }
 
 static void dispatch_control_flow(struct msg *req) {
+	bool has_arg = req->hdr.size >= sizeof(uint32_t);
+	uint32_t arg = has_arg ? *(uint32_t*)req->payload : 0;
+
 	switch (req->hdr.subtype.control_flow) {
 		case CONTROL_FLOW_UNTIL:
 			uint32_t until_addr = *(uint32_t*)req->payload;
@@ -124,8 +828,45 @@ static void dispatch_control_flow(struct msg *req) {
 		case CONTROL_FLOW_NEXT:
 			handle_control_flow_next();
 			break;
+		case CONTROL_FLOW_STEP:
+			start_run(RUN_STEPS, CONTROL_FLOW_STEP, arg, has_arg);
+			break;
+		case CONTROL_FLOW_RUN_CYCLES:
+			start_run(RUN_CYCLES, CONTROL_FLOW_RUN_CYCLES, arg, has_arg);
+			break;
+		case CONTROL_FLOW_RUN_FRAME:
+			start_run(RUN_FRAME, CONTROL_FLOW_RUN_FRAME, arg, has_arg);
+			break;
+		case CONTROL_FLOW_RUN_SCANLINE:
+			start_run(RUN_SCANLINE, CONTROL_FLOW_RUN_SCANLINE, arg, has_arg);
+			break;
+		case CONTROL_FLOW_STEP_OVER:
+			start_run(RUN_STEP_OVER, CONTROL_FLOW_STEP_OVER, arg, has_arg);
+			break;
 		case CONTROL_FLOW_BREAK:
-			handle_control_flow_break(*(uint32_t*)req->payload);
+			handle_control_flow_break(req->payload, req->hdr.size);
+			break;
+		case CONTROL_FLOW_LOGPOINT:
+			handle_control_flow_logpoint(req->payload, req->hdr.size);
+			break;
+		case CONTROL_FLOW_WATCH:
+			handle_control_flow_watch(req->payload, req->hdr.size);
+			break;
+		case CONTROL_FLOW_DELETE_WATCH:
+			handle_control_flow_delete_watch(req->payload, req->hdr.size);
+			break;
+		case CONTROL_FLOW_REVERSE_STEP:
+			handle_control_flow_reverse(CONTROL_FLOW_REVERSE_STEP, REVERSE_STEP, 0);
+			break;
+		case CONTROL_FLOW_REVERSE_CONTINUE:
+			handle_control_flow_reverse(CONTROL_FLOW_REVERSE_CONTINUE, REVERSE_CONTINUE, 0);
+			break;
+		case CONTROL_FLOW_REVERSE_TO_WRITE:
+			if (!has_arg) {
+				fprintf(stderr, "error: dispatch_control_flow(): missing address\n");
+				return;
+			}
+			handle_control_flow_reverse(CONTROL_FLOW_REVERSE_TO_WRITE, REVERSE_TO_WRITE, arg);
 			break;
 		default:
 			fprintf(stderr, "error: control_flow_get_answer()");
@@ -133,127 +874,245 @@ static void dispatch_control_flow(struct msg *req) {
 	}
 }
 
-static void dispatch_inspect(struct msg *req, struct msg *answer) {
-	struct peek peek;
-	struct peek_reply peek_reply;
+// replies to inspect requests are built here; there's a single client, so
+// this is the connection's arena.
+// big enough for a whole address space read, plus some batched peeks.
+#define INSPECT_MEM_MAX 0x10000
+#define INSPECT_REPLY_MAX (INSPECT_MEM_MAX + 0x1000)
+static uint8_t inspect_reply[INSPECT_REPLY_MAX];
 
-	switch (req->hdr.subtype.inspect) {
+// one peek of an INSPECT_BATCH request.
+struct inspect_desc {
+	uint32_t subtype; // INSPECT_*, other than INSPECT_BATCH
+	uint32_t req;
+	uint32_t len; // for INSPECT_READ_MEM
+};
+
+static int inspect_to_peek(struct inspect_desc *desc, struct peek *peek) {
+	peek->req = desc->req;
+	peek->len = 0;
+	switch (desc->subtype) {
 		case INSPECT_GET_CPU_REG:
-			answer->hdr.subtype.inspect = INSPECT_GET_CPU_REG;
-			peek.type = PEEK_CPU;
-			peek.subtype = CPU_PEEK_REG;
-			peek.req = *(uint32_t*)req->payload;
+			peek->type = PEEK_CPU;
+			peek->subtype = CPU_PEEK_REG;
 			break;
 		case INSPECT_GET_PPU_REG:
-			answer->hdr.subtype.inspect = INSPECT_GET_PPU_REG;
-			peek.type = PEEK_PPU;
-			peek.subtype = PPU_PEEK_REG;
-			peek.req = *(uint32_t*)req->payload;
+			peek->type = PEEK_PPU;
+			peek->subtype = PPU_PEEK_REG;
 			break;
 		case INSPECT_PRINT_ADDR:
-			answer->hdr.subtype.inspect = INSPECT_PRINT_ADDR;
-			peek.type = PEEK_CPU;
-			peek.subtype = CPU_PEEK_ADDR;
-			peek.req = *(uint32_t*)req->payload;
+			peek->type = PEEK_CPU;
+			peek->subtype = CPU_PEEK_ADDR;
 			break;
 		case INSPECT_GET_INSTR_AT_ADDR:
-			answer->hdr.subtype.inspect = INSPECT_GET_INSTR_AT_ADDR;
-			peek.type = PEEK_CPU;
-			peek.subtype = CPU_PEEK_INSTR_AT_ADDR;
-			peek.req = *(uint32_t*)req->payload;
+			peek->type = PEEK_CPU;
+			peek->subtype = CPU_PEEK_INSTR_AT_ADDR;
 			break;
 		case INSPECT_GET_OP_LEN:
-			answer->hdr.subtype.inspect = INSPECT_GET_OP_LEN;
-			peek.type = PEEK_CPU;
-			peek.subtype = CPU_PEEK_OP_LEN;
-			peek.req = *(uint32_t*)req->payload;
+			peek->type = PEEK_CPU;
+			peek->subtype = CPU_PEEK_OP_LEN;
+			break;
+		case INSPECT_READ_MEM:
+			if (!desc->len || desc->len > INSPECT_MEM_MAX || desc->req >= 0x10000 ||
+					desc->len > 0x10000 - desc->req) {
+				fprintf(stderr, "error: inspect_to_peek(): bad memory range\n");
+				return -1;
+			}
+			peek->type = PEEK_CPU;
+			peek->subtype = CPU_PEEK_MEM;
+			peek->len = desc->len;
 			break;
 		default:
-			fprintf(stderr, "error: handle_inspect()");
+			fprintf(stderr, "error: inspect_to_peek()");
+			return -1;
+	}
+	return 0;
+}
+
+static int do_inspect(struct inspect_desc *desc, struct peek_reply *peek_reply) {
+	struct peek peek;
+	if (inspect_to_peek(desc, &peek) == -1) {
+		return -1;
 	}
 
 	switch (peek.type) {
 		case PEEK_CPU:
-			cpu_peek(&peek, &peek_reply);
-			break;
+			return cpu_peek(&peek, peek_reply);
 		case PEEK_PPU:
-			ppu_peek(&peek, &peek_reply);
-			break;
+			return ppu_peek(&peek, peek_reply);
 	}
-	answer->hdr.size = peek_reply.size;
-	answer->payload = peek_reply.payload;
+	return -1;
 }
-#endif
-
-static int set_stop_request() {
-	if (pthread_rwlock_wrlock(&quick_lock) != 0) {
-		perror("pthread_rwlock_wrlock()");
-		return -1;
-	}
-	server_stop_request = true;
 
-	pthread_rwlock_unlock(&quick_lock);
+// INSPECT_BATCH: the request holds an array of struct inspect_desc, and the
+// reply each of their replies, in order, as a u32 size followed by the
+// payload.
+static int do_inspect_batch(struct msg *req, struct peek_reply *peek_reply) {
+	size_t num = req->hdr.size / sizeof(struct inspect_desc);
+	struct inspect_desc *descs = req->payload;
 
+	for (size_t i = 0; i < num; i++) {
+		if (descs[i].subtype == INSPECT_BATCH) {
+			fprintf(stderr, "error: do_inspect_batch(): nested batch\n");
+			return -1;
+		}
+		size_t size_offset = peek_reply->size;
+		uint32_t size = 0;
+		if (peek_reply_put(peek_reply, &size, sizeof(size)) == -1 ||
+				do_inspect(&descs[i], peek_reply) == -1) {
+			return -1;
+		}
+		size = peek_reply->size - size_offset - sizeof(size);
+		memcpy((uint8_t *)peek_reply->payload + size_offset, &size, sizeof(size));
+	}
 	return 0;
 }
 
-int server_recv_request_and_dispatch() {
-#ifdef HAVE_LIBEMU
-	pthread_mutex_lock(&mtx_server);
+// the reply is empty if the request can't be answered.
+static int dispatch_inspect(struct msg *req, struct msg *answer) {
+	struct peek_reply peek_reply = {
+		.capacity = sizeof(inspect_reply),
+		.payload = inspect_reply
+	};
 
-	struct msg req = {};
 	int ret;
-	// if successful, allocates request payload
-	if ((ret = emu_recv_msg(&req, 0)) == -1)
-		goto out;
+	answer->hdr.subtype.inspect = req->hdr.subtype.inspect;
+	switch (req->hdr.subtype.inspect) {
+		case INSPECT_BATCH:
+			ret = do_inspect_batch(req, &peek_reply);
+			break;
+		case INSPECT_READ_MEM:
+			// u32 address, u32 length
+			if (req->hdr.size < 2*sizeof(uint32_t)) {
+				ret = -1;
+				break;
+			}
+			struct inspect_desc mem = {
+				.subtype = INSPECT_READ_MEM,
+				.req = ((uint32_t *)req->payload)[0],
+				.len = ((uint32_t *)req->payload)[1]
+			};
+			ret = do_inspect(&mem, &peek_reply);
+			break;
+		default:
+			if (req->hdr.size < sizeof(uint32_t)) {
+				ret = -1;
+				break;
+			}
+			struct inspect_desc desc = {
+				.subtype = req->hdr.subtype.inspect,
+				.req = *(uint32_t *)req->payload
+			};
+			ret = do_inspect(&desc, &peek_reply);
+	}
+
+	answer->hdr.size = ret == -1 ? 0 : peek_reply.size;
+	answer->payload = peek_reply.payload;
+	return ret;
+}
 
-	switch (req.hdr.type) {
+// a request from the queue, on the emulation thread.
+static void dispatch_request(struct msg *req) {
+	switch (req->hdr.type) {
 		case TYPE_CONTROL_FLOW:
 			if (server_running) {
 				fprintf(stderr, "received TYPE_CONTROL_FLOW request while running\n");
-				goto out;
+				break;
 			}
-			dispatch_control_flow(&req);
-			pthread_cond_signal(&cnd_server_stop);
+			dispatch_control_flow(req);
 			break;
 		case TYPE_INSPECT:
 			if (server_running) {
 				fprintf(stderr, "received TYPE_INSPECT request while running\n");
-				goto out;
+				break;
 			}
 			struct msg answer = {};
 			answer.hdr.type = TYPE_INSPECT;
-			dispatch_inspect(&req, &answer); // allocates reply payload
-			ret = emu_send_msg(&answer);
-			free((void *)answer.payload); // frees reply payload
+			// an empty reply if the request can't be answered
+			dispatch_inspect(req, &answer);
+			emu_send_msg(&answer);
 			break;
 		case TYPE_MONITOR:
-			if (server_running && req.hdr.subtype.monitor == MONITOR_RESUME) {
+			if (req->hdr.subtype.monitor == MONITOR_GET_LIVE_VIEW) {
+				handle_monitor_get_live_view();
+				break;
+			}
+			if (req->hdr.subtype.monitor == MONITOR_DRAIN_LOG) {
+				handle_monitor_drain_log();
+				break;
+			}
+			if (server_running && req->hdr.subtype.monitor == MONITOR_RESUME) {
 				fprintf(stderr, "received TYPE_MONITOR MONITOR_RESUME request while running\n");
-				goto out;
+				break;
+			}
+			if (server_running && req->hdr.subtype.monitor == MONITOR_SUBSCRIBE_MEM) {
+				fprintf(stderr, "received TYPE_MONITOR MONITOR_SUBSCRIBE_MEM request while running\n");
+				break;
 			}
-			if (!server_running && req.hdr.subtype.monitor == MONITOR_STOP) {
+			if (!server_running && req->hdr.subtype.monitor == MONITOR_STOP) {
 				fprintf(stderr, "received TYPE_MONITOR MONITOR_STOP request while not running\n");
-				goto out;
+				break;
 			}
-			dispatch_monitor(&req);
-			if (req.hdr.subtype.monitor == MONITOR_STOP) {
-				if (set_stop_request() == -1) {
-					goto out;
-				}
-				pthread_cond_wait(&cnd_server_stop, &mtx_server);
+			dispatch_monitor(req);
+			if (req->hdr.subtype.monitor == MONITOR_STOP) {
+				// a stop cancels any run in progress.
+				run.target = RUN_NONE;
+				push_mem_delta();
 			}
 			break;
 	}
+}
+#endif
 
-out:
-	// we own the possible allocation from libemu
-	if (req.hdr.size)
-		free(req.payload);
-	pthread_mutex_unlock(&mtx_server);
-	return ret;
-#else
+// on the io thread: queue the next request for the emulation thread.
+int server_recv_request() {
+#ifdef HAVE_LIBEMU
+	struct msg req = {};
+	// if successful, allocates request payload
+	if (emu_recv_msg(&req, 0) == -1)
+		return -1;
+
+	uint32_t head = atomic_load_explicit(&requests.head, memory_order_relaxed);
+	// only a client sending a burst of requests while the emulation thread
+	// is busy (eg, going back in time) can fill this up; wait it out.
+	while (head - atomic_load_explicit(&requests.tail, memory_order_acquire) == REQUEST_QUEUE_SIZE) {
+		nanosleep(&(struct timespec){ .tv_nsec = 100000 }, nullptr);
+	}
+	requests.queue[head & REQUEST_QUEUE_MASK] = req;
+	atomic_store_explicit(&requests.head, head+1, memory_order_release);
+	eventfd_write(requests.wakeup_fd, 1);
+#endif
 	return 0;
+}
+
+// on the emulation thread: dispatch whatever has been queued; returns how
+// many requests there were.
+int server_dispatch_requests() {
+	int num_requests = 0;
+#ifdef HAVE_LIBEMU
+	uint32_t tail = atomic_load_explicit(&requests.tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&requests.head, memory_order_acquire);
+	for (; tail != head; tail++, num_requests++) {
+		struct msg *req = &requests.queue[tail & REQUEST_QUEUE_MASK];
+		dispatch_request(req);
+		// we own the possible allocation from libemu
+		if (req->hdr.size)
+			free(req->payload);
+		atomic_store_explicit(&requests.tail, tail+1, memory_order_release);
+	}
+#endif
+	return num_requests;
+}
+
+// on the emulation thread, while stopped: dispatch the queued requests, or
+// sleep until there are some.
+void server_wait_requests() {
+#ifdef HAVE_LIBEMU
+	if (!server_dispatch_requests()) {
+		// the count is just a wakeup; the queue is what holds the requests.
+		eventfd_t count;
+		eventfd_read(requests.wakeup_fd, &count);
+	}
 #endif
 }
 
@@ -273,29 +1132,35 @@ bool server_is_stopped() {
 	return !server_running;
 }
 
-static bool hit_breakpoint() {
+static bool hit_breakpoint(uint16_t pc) {
 	bool ret = false;
 #ifdef HAVE_LIBEMU
-	struct peek peek = {};
-	struct peek_reply peek_reply = {};
-	peek.type = PEEK_CPU;
-	peek.subtype = CPU_PEEK_REG;
-	peek.req = CPU_REG_PC;
-	cpu_peek(&peek, &peek_reply);
-	uint32_t addr = *(uint32_t*)peek_reply.payload;
-	free(peek_reply.payload);
+	uint32_t addr = pc;
+
+	// logpoints log whatever the mode.
+	bool is_breakpoint = is_breakpoint_addr(pc) && check_breakpoints(pc);
+	if (watch_exec_pages[pc >> 8]) {
+		uint8_t op = monitor_peek_mem(pc);
+		check_watchpoints(MONITOR_WATCH_EXEC, pc, op, op);
+	}
 
 	struct msg msg_reply;
 	msg_reply.hdr.type = TYPE_CONTROL_FLOW;
-	if (control_flow_continue || control_flow_until) {
-		uint32_t breakpoint;
-		list_for_each(breakpoint_list, breakpoint) {
-			if (breakpoint == addr) {
-				msg_reply.hdr.subtype.control_flow = CONTROL_FLOW_BREAK;
-				control_flow_continue = 0;
-				ret = true;
-				break;
-			}
+	if (control_flow_continue || control_flow_until || run.target != RUN_NONE) {
+		if (is_watch_hit) {
+			msg_reply.hdr.subtype.control_flow = CONTROL_FLOW_WATCH;
+			msg_reply.hdr.size = sizeof(watch_hit);
+			msg_reply.payload = &watch_hit;
+			emu_send_msg(&msg_reply);
+			control_flow_continue = false;
+			control_flow_until = false;
+			run.target = RUN_NONE;
+			ret = true;
+		}
+		else if (is_breakpoint) {
+			msg_reply.hdr.subtype.control_flow = CONTROL_FLOW_BREAK;
+			control_flow_continue = 0;
+			ret = true;
 		}
 
 		if (control_flow_until) {
@@ -307,14 +1172,19 @@ static bool hit_breakpoint() {
 				ret = true;
 			}
 		}
-		if (ret) {
-			msg_reply.hdr.size = 4;
-			msg_reply.payload = malloc(sizeof(uint32_t));
-			memcpy(msg_reply.payload, &addr, sizeof(uint32_t));
+		if (!ret && run.target != RUN_NONE && is_run_done(pc)) {
+			msg_reply.hdr.subtype.control_flow = run.subtype;
+			ret = true;
+		}
+		if (ret && !is_watch_hit) {
+			run.target = RUN_NONE;
+			msg_reply.hdr.size = sizeof(addr);
+			msg_reply.payload = &addr;
 			emu_send_msg(&msg_reply);
-			free(msg_reply.payload);
 		}
 	}
+	is_watch_hit = false;
+	insn_pc = pc;
 
 	if (control_flow_next) {
 		msg_reply.hdr.size = 0;
@@ -324,29 +1194,36 @@ static bool hit_breakpoint() {
 		ret = true;
 	}
 
-	if (ret)
+	if (ret) {
 		stop_execution();
+		push_mem_delta();
+	}
 #endif
 	return ret;
 }
 
-bool got_stop_request() {
-	if (!pthread_rwlock_tryrdlock(&quick_lock)) {
-		if (server_stop_request) {
-			server_stop_request = false;
-			pthread_rwlock_unlock(&quick_lock);
-			return true;
-		}
-		pthread_rwlock_unlock(&quick_lock);
-	}
-	return false;
-}
-
+// called after every instruction while a client is connected; the common
+// case (not stopped by a request, and no breakpoint, watch or 'until' at pc)
+// is a couple of loads and bit tests.
 bool server_should_stop_execution() {
-	return got_stop_request() || hit_breakpoint();
+	if (!server_running) {
+		return true;
+	}
+	uint16_t pc = cpu_get_pc();
+	if (!control_flow_next && run.target == RUN_NONE && !is_breakpoint_addr(pc) &&
+			!is_watch_hit && !watch_exec_pages[pc >> 8] &&
+			!(control_flow_until && pc == until_addr)) {
+		insn_pc = pc;
+		return false;
+	}
+	return hit_breakpoint(pc);
 }
 
 void server_fini() {
+#ifdef HAVE_LIBEMU
+	if (requests.wakeup_fd != -1)
+		close(requests.wakeup_fd);
+#endif
 }
 
 int server_init(bool wait_for_client) {
@@ -366,7 +1243,15 @@ int server_init(bool wait_for_client) {
 	}
 
 	breakpoint_list = create_list();
-	if (!breakpoint_list) {
+	watchpoint_list = create_list();
+	if (!breakpoint_list || !watchpoint_list) {
+		return -1;
+	}
+	monitor_set_watch_handler(check_watchpoints);
+
+	requests.wakeup_fd = eventfd(0, EFD_CLOEXEC);
+	if (requests.wakeup_fd == -1) {
+		perror("eventfd()");
 		return -1;
 	}
 